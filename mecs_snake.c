@@ -4,6 +4,8 @@
 // All data is stored in components; all behavior is implemented in systems.
 // The system has no explicit concept of a "snake" — only data and logic.
 // This is obviously not the best way to implement Snake; it's just a demo.
+// Run with --headless [ticks] to benchmark the simulation: an AI steers,
+// nothing is drawn and nothing sleeps.
 //
 // Suggested ECS-based extensions:
 // - Add multiple snakes (each with its own Interactable + Direction)
@@ -13,9 +15,10 @@
 // - Add portals: position-linked entities that warp consumers
 // - Visual effects via transient Drawable-only "particles"
 
-#include "mini_ecs.h"
 #define _POSIX_C_SOURCE 199309L
+#include "mini_ecs.h"
 #include <time.h>
+#include <limits.h>
 #include <termios.h>
 #include <string.h>
 #include <stdlib.h>
@@ -26,44 +29,40 @@
 
 #define WIDTH 20
 #define HEIGHT 10
-#define INVALID_ENTITY ((Entity)-1)
 
 struct termios orig_termios;
 
-typedef struct { } Collidable;
-typedef struct { } Consumer;
-typedef struct { } Interactable;
 typedef enum { UP, DOWN, LEFT, RIGHT } Direction;
 typedef struct { char symbol; } Drawable;
 typedef struct { int points; bool grows; bool resets; } Edible;
 typedef struct { Entity lead; Entity follower; } Following;
 typedef struct { int x, y; } Position;
 
-#define positions_equal(a, b) ((a).x == (b).x && (a).y == (b).y)
+#define SNAKE_COMPONENTS(C, S, T, R) \
+    T(collidable) \
+    T(consumer) \
+    C(Direction, direction) \
+    C(Drawable, drawable) \
+    C(Position, drawn) \
+    S(Edible, edible) \
+    R(follower) \
+    T(interactable) \
+    C(Position, position)
 
 typedef struct {
     EntityManager em;
-    MECS_DEFINE_COMPONENT(Collidable, collidable);
-    MECS_DEFINE_COMPONENT(Consumer, consumer);
-    MECS_DEFINE_COMPONENT(Direction, direction);
-    MECS_DEFINE_COMPONENT(Drawable, drawable);
-    MECS_DEFINE_COMPONENT(Edible, edible);
-    MECS_DEFINE_COMPONENT(Entity, follower);
-    MECS_DEFINE_COMPONENT(Interactable, interactable);
-    MECS_DEFINE_COMPONENT(Position, position);
+    MECS_WORLD_COMPONENTS(SNAKE_COMPONENTS)
+    MecsCommandBuffer commands; // applied at the end of each update
+    MecsScheduler systems;
+    MecsHierarchy chains; // followers, each after the segment it follows
+    MecsGrid board; // entities by position
+    MecsObserver undrawn, erased; // drawables that vanish from the screen
+    char screen[HEIGHT][WIDTH]; // what render last drew
+    uint32_t rendered; // tick of the last render
     int score;
 } SnakeWorld;
 
-void clear_components(SnakeWorld* game, Entity e) {
-    MECS_CLEAR_COMPONENT(game, collidable, e);
-    MECS_CLEAR_COMPONENT(game, consumer, e);
-    MECS_CLEAR_COMPONENT(game, direction, e);
-    MECS_CLEAR_COMPONENT(game, drawable, e);
-    MECS_CLEAR_COMPONENT(game, edible, e);
-    MECS_CLEAR_COMPONENT(game, follower, e);
-    MECS_CLEAR_COMPONENT(game, interactable, e);
-    MECS_CLEAR_COMPONENT(game, position, e);
-}
+MECS_DEFINE_WORLD_REGISTER(SnakeWorld, SNAKE_COMPONENTS)
 
 static inline void sleep_ms(int milliseconds) {
     struct timespec ts;
@@ -75,7 +74,6 @@ static inline void sleep_ms(int milliseconds) {
 // Game lifecycle
 static SnakeWorld* new_game();
 static void free_game(SnakeWorld* game);
-static void destroy_entity(SnakeWorld* game, Entity e);
 
 // Snake initialization and growth
 static void init_snake(SnakeWorld* game, int length);
@@ -86,14 +84,14 @@ static void grow(SnakeWorld* game, Entity lead);
 
 // Apple/edible logic
 static Entity init_apple(SnakeWorld* game);
-static bool is_occupied(SnakeWorld* game, Position pos);
 static void place_edible(SnakeWorld* game, Entity edible);
 
 // Game state and logic updates
 static void update_state(SnakeWorld* game);
-static void update_interactables(SnakeWorld* game);
-static void update_followers_of(SnakeWorld* game, Entity leader);
-static void update_edibles(SnakeWorld* game);
+static void update_interactables(void* world);
+static void update_followers(SnakeWorld* game);
+static void update_edibles(void* world);
+static void flush_commands(void* world);
 static bool game_over(SnakeWorld* game);
 
 // Input and rendering
@@ -101,6 +99,8 @@ static void handle_input(SnakeWorld* game);
 static int kbhit(); // Returns true if a key was pressed (non-blocking)
 static char get_key(); // Reads a single key if available, or 0 otherwise
 static void render(SnakeWorld* game);
+static void forget_drawn(void* world, Entity e);
+static void erase_drawn(void* world, Entity e);
 
 // Terminal and system setup
 static void reset_terminal_mode(); // Restore terminal to original settings on exit
@@ -108,7 +108,15 @@ static void set_conio_terminal_mode(); // Switch to raw terminal mode (disable b
 static void init_system();
 static void teardown_system();
 
-int main() {
+// Headless benchmark
+static uint64_t clock_ns(void);
+static void steer(SnakeWorld* game);
+static int run_headless(long ticks);
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "--headless") == 0)
+        return run_headless(argc > 2 ? atol(argv[2]) : 100000);
+
     init_system();
     SnakeWorld* game = new_game();
 init_snake(game, 3);
@@ -131,18 +139,34 @@ init_snake(game, 3);
 
 SnakeWorld* new_game() {
     SnakeWorld* game = calloc(1, sizeof(SnakeWorld));
+    mecs_register_SnakeWorld(game);
+    MECS_TRACK_CHANGES(game, position);
+    MECS_GRID_INIT(game, &game->board, Position, position, x, y, WIDTH, HEIGHT, 1);
+    MECS_OBSERVE(game, &game->undrawn, drawable, NULL, forget_drawn, NULL, game);
+    MECS_OBSERVE(game, &game->erased, drawn, NULL, erase_drawn, NULL, game);
+    memset(game->screen, '.', sizeof(game->screen));
+
+    size_t s = mecs_system_add(&game->systems, "interactables", update_interactables);
+    MECS_SYSTEM_READS(&game->systems, s, game, direction, follower);
+    MECS_SYSTEM_WRITES(&game->systems, s, game, position);
+    s = mecs_system_add(&game->systems, "edibles", update_edibles);
+    MECS_SYSTEM_READS(&game->systems, s, game, consumer, edible);
+    MECS_SYSTEM_WRITES(&game->systems, s, game, position);
+    s = mecs_system_add(&game->systems, "flush", flush_commands);
+    mecs_system_exclusive(&game->systems, s);
     return game;
 }
 
 void free_game(SnakeWorld* game) {
+    mecs_cmd_free(&game->commands);
+    mecs_hierarchy_free(&game->chains);
+    mecs_grid_free(&game->em, &game->board);
+    mecs_observer_free(&game->em, &game->undrawn);
+    mecs_observer_free(&game->em, &game->erased);
+    mecs_storage_free(&game->em);
     free(game);
 }
 
-void destroy_entity(SnakeWorld* game, Entity e) {
-    clear_components(game, e);
-    mecs_entity_destroy(&game->em, e);
-}
-
 void init_snake(SnakeWorld* game, int length) {
     Entity snake[length];
 
@@ -159,126 +183,113 @@ void init_snake(SnakeWorld* game, int length) {
 
 Entity create_snake_head(SnakeWorld* game, Position pos, Direction dir) {
     Entity head = mecs_entity_create(&game->em);
-    MECS_SET_COMPONENT(game, interactable, head, ((Interactable){ }));
+    MECS_SET_TAG(game, interactable, head);
     MECS_SET_COMPONENT(game, direction, head, dir);
-    MECS_SET_COMPONENT(game, consumer, head, ((Consumer){ }));
+    MECS_SET_TAG(game, consumer, head);
     MECS_SET_COMPONENT(game, drawable, head, ((Drawable){ 'O' }));
     MECS_SET_COMPONENT(game, position, head, pos);
-    MECS_SET_COMPONENT(game, collidable, head, ((Collidable){ }));
+    MECS_SET_TAG(game, collidable, head);
     return head;
 }
 
 Entity create_snake_segment(SnakeWorld* game, Position pos, Entity follows) {
     Entity segment = mecs_entity_create(&game->em);
     MECS_SET_COMPONENT(game, position, segment, pos);
-    MECS_SET_COMPONENT(game, follower, segment, follows);
+    MECS_SET_RELATION(game, follower, segment, follows);
     MECS_SET_COMPONENT(game, drawable, segment, ((Drawable){ 'o' }));
-    MECS_SET_COMPONENT(game, collidable, segment, ((Collidable){ }));
+    MECS_SET_TAG(game, collidable, segment);
     return segment;
 }
 
 Entity last_follower(SnakeWorld* game, Entity lead) {
-    Entity map[MAX_ENTITIES];
-    memset(map, 0xFF, sizeof(map)); // Set all to INVALID_ENTITY
-
-    // Build map: lead -> follower
-    MECS_FOREACH_2(game, position, follower, e) {
-        Entity l = game->follower[e];
-        if (l < MAX_ENTITIES)
-            map[l] = e;
-    }
-
-    // Walk the chain starting from `lead`
     Entity current = lead;
-    while (current < MAX_ENTITIES && map[current] != INVALID_ENTITY)
-        current = map[current];
-
+    while (MECS_HAS_CHILDREN(game, follower, current))
+        current = MECS_FIRST_CHILD(game, follower, current);
     return current;
 }
 
+// Deferred: the new segment appears when the update's commands are flushed.
 void grow(SnakeWorld* game, Entity lead) {
     Entity tail = last_follower(game, lead);
-    create_snake_segment(game, game->position[tail], tail);
+    Entity segment = mecs_cmd_create(&game->commands);
+    MECS_CMD_SET(&game->commands, game, Position, position, segment, game->position[tail]);
+    MECS_CMD_SET(&game->commands, game, Entity, follower, segment, tail);
+    MECS_CMD_SET(&game->commands, game, Drawable, drawable, segment, ((Drawable){ 'o' }));
+    MECS_CMD_SET_TAG(&game->commands, game, collidable, segment);
 }
 
 Entity init_apple(SnakeWorld* game) {
     Entity apple = mecs_entity_create(&game->em);
     MECS_SET_COMPONENT(game, drawable, apple, ((Drawable){ '@' }));
-    MECS_SET_COMPONENT(game, edible, apple, ((Edible){ 1, true, true }));
+    MECS_SET_SPARSE_COMPONENT(game, edible, apple, ((Edible){ 1, true, true }));
     MECS_SET_COMPONENT(game, position, apple, ((Position){ 0, 0 }));
     return apple;
 }
 
-bool is_occupied(SnakeWorld* game, Position pos) {
-    MECS_FOREACH_1(game, position, e) {
-        if (positions_equal(game->position[e], pos)) {
-            return true;
-        }
-    }
-
-    return false;
-}
-
 void place_edible(SnakeWorld* game, Entity edible) {
     Position pos;
-    do {
-        pos.x = rand() % WIDTH;
-        pos.y = rand() % HEIGHT;
-    } while (is_occupied(game, pos));
+    if (game->board.empty_count == 0) return; // the snake fills the board
 
+    mecs_grid_empty_cell(&game->board, (size_t)rand() % game->board.empty_count, &pos.x, &pos.y);
     MECS_SET_COMPONENT(game, position, edible, pos);
 }
 
 void update_state(SnakeWorld* game) {
-
-    update_interactables(game);
-    update_edibles(game);
+    mecs_scheduler_run(&game->systems, game);
 }
 
-void update_interactables(SnakeWorld* game) {
+void update_interactables(void* world) {
+    SnakeWorld* game = world;
+    update_followers(game);
     MECS_FOREACH_2(game, position, direction, e) {
         Position* p = &game->position[e];
         Direction d = game->direction[e];
-        update_followers_of(game, e);
         switch (d) {
             case UP:    p->y--; break;
             case DOWN:  p->y++; break;
             case LEFT:  p->x--; break;
             case RIGHT: p->x++; break;
         }
+        MECS_MARK_CHANGED(game, position, e);
     }
 }
 
-void update_followers_of(SnakeWorld* game, Entity leader) {
-    Position* leader_pos = &game->position[leader];
-
-    MECS_FOREACH_2(game, position, follower, e) {
-        if (game->follower[e] == leader) {
-            update_followers_of(game, e);
-            game->position[e] = *leader_pos;
-        }
+// Tail first, so every segment takes its leader's position from before
+// the move.
+void update_followers(SnakeWorld* game) {
+    MECS_HIERARCHY_UPDATE(game, follower, &game->chains);
+    MECS_FOREACH_BOTTOMUP(&game->chains, e) {
+        game->position[e] = game->position[MECS_GET_RELATION(game, follower, e)];
+        MECS_MARK_CHANGED(game, position, e);
     }
 }
 
-void update_edibles(SnakeWorld* game) {
+void update_edibles(void* world) {
+    SnakeWorld* game = world;
     MECS_FOREACH_2(game, position, consumer, mouth) {
-        Position* mouth_pos = &game->position[mouth];
+        Position mouth_pos = game->position[mouth];
 
-        MECS_FOREACH_2(game, position, edible, food) {
-            if (positions_equal(*mouth_pos, game->position[food])) {
-                Edible* ef = &game->edible[food];
+        MECS_FOREACH_AT(&game->board, mouth_pos.x, mouth_pos.y, food) {
+            if (MECS_HAS_COMPONENT(game, edible, food)) {
+                Edible* ef = &MECS_GET_SPARSE_COMPONENT(game, edible, food);
                 game->score += ef->points;
                 if (ef->grows) grow(game, mouth);
                 if (ef->resets) {
                     place_edible(game, food);
                 } else {
-                    destroy_entity(game, food);
+                    mecs_cmd_destroy(&game->commands, food);
                 }
             }
         }
     }
 }
 
+void flush_commands(void* world) {
+    SnakeWorld* game = world;
+    mecs_cmd_flush(&game->em, &game->commands);
+    mecs_observers_flush(&game->em);
+}
+
 bool game_over(SnakeWorld* game) {
     MECS_FOREACH_2(game, position, interactable, i) {
         Position ipos = game->position[i];
@@ -289,11 +300,8 @@ bool game_over(SnakeWorld* game) {
         }
 
         // Hit something collidable (like a snake segment)
-        MECS_FOREACH_2(game, position, collidable, c) {
-            if (i == c) continue;
-
-            Position cpos = game->position[c];
-            if(positions_equal(ipos, cpos)) {
+        MECS_FOREACH_AT(&game->board, ipos.x, ipos.y, c) {
+            if (i != c && MECS_HAS_COMPONENT(game, collidable, c)) {
                 return true;
             }
         }
@@ -336,18 +344,26 @@ char get_key() {
     return 0;
 }
 
+// Only drawables that moved since the last frame touch the screen grid:
+// all their old cells are erased before any new cell is drawn. Drawables
+// that are destroyed or stop being drawable are erased by the observers
+// below when commands are flushed.
 void render(SnakeWorld* game) {
-    char grid[HEIGHT][WIDTH];
-    for (int y = 0; y < HEIGHT; ++y)
-        for (int x = 0; x < WIDTH; ++x)
-            grid[y][x] = '.';
+    MECS_FOREACH(game, e, drawable, drawn, MECS_CHANGED(position, game->rendered)) {
+        Position p = game->drawn[e];
+        if ((unsigned)p.x < WIDTH && (unsigned)p.y < HEIGHT) {
+            game->screen[p.y][p.x] = '.';
+        }
+    }
 
-    MECS_FOREACH_2(game, drawable, position, e) {
+    MECS_FOREACH(game, e, drawable, MECS_CHANGED(position, game->rendered)) {
         Position p = game->position[e];
         if ((unsigned)p.x < WIDTH && (unsigned)p.y < HEIGHT) {
-            grid[p.y][p.x] = game->drawable[e].symbol;
+            game->screen[p.y][p.x] = game->drawable[e].symbol;
         }
+        MECS_SET_COMPONENT(game, drawn, e, p);
     }
+    game->rendered = mecs_tick(&game->em);
 
     printf("\033[2J\033[H"); // ANSI escape: clear screen and reset cursor position
 
@@ -360,7 +376,7 @@ void render(SnakeWorld* game) {
     for (int y = 0; y < HEIGHT; ++y) {
         printf("│");
         for (int x = 0; x < WIDTH; ++x) {
-            printf("%c", grid[y][x]);
+            printf("%c", game->screen[y][x]);
         }
         printf("│\n");
     }
@@ -373,6 +389,28 @@ void render(SnakeWorld* game) {
     printf("Score: %i\n", game->score);
 }
 
+void forget_drawn(void* world, Entity e) {
+    SnakeWorld* game = world;
+    MECS_CLEAR_COMPONENT(game, drawn, e);
+}
+
+// Blanks the cell e was last drawn in, then restores anything else
+// already drawn there.
+void erase_drawn(void* world, Entity e) {
+    SnakeWorld* game = world;
+    Position p = game->drawn[e];
+    if ((unsigned)p.x >= WIDTH || (unsigned)p.y >= HEIGHT) return;
+
+    game->screen[p.y][p.x] = '.';
+    MECS_FOREACH_AT(&game->board, p.x, p.y, other) {
+        Position q = game->drawn[other];
+        if (MECS_HAS_COMPONENT(game, drawable, other) && MECS_HAS_COMPONENT(game, drawn, other) &&
+            q.x == p.x && q.y == p.y) {
+            game->screen[p.y][p.x] = game->drawable[other].symbol;
+        }
+    }
+}
+
 void reset_terminal_mode() {
     tcsetattr(0, TCSANOW, &orig_termios);
 }
@@ -399,3 +437,83 @@ void teardown_system() {
     reset_terminal_mode();
     printf("\033[?25h"); // show cursor
 }
+
+uint64_t clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Turns each head toward the edible, avoiding walls and anything
+// collidable when it can.
+void steer(SnakeWorld* game) {
+    static const Position step[] = { [UP] = { 0, -1 }, [DOWN] = { 0, 1 }, [LEFT] = { -1, 0 }, [RIGHT] = { 1, 0 } };
+    static const Direction reverse[] = { [UP] = DOWN, [DOWN] = UP, [LEFT] = RIGHT, [RIGHT] = LEFT };
+    Position target = { 0, 0 };
+    MECS_FOREACH_2(game, position, edible, food) target = game->position[food];
+
+    MECS_FOREACH_3(game, position, interactable, direction, e) {
+        Position head = game->position[e];
+        Direction best = game->direction[e];
+        int best_cost = INT_MAX;
+
+        for (Direction d = UP; d <= RIGHT; ++d) {
+            if (d == reverse[game->direction[e]]) continue;
+
+            Position next = { head.x + step[d].x, head.y + step[d].y };
+            int cost = abs(target.x - next.x) + abs(target.y - next.y);
+            if (next.x < 0 || next.x >= WIDTH || next.y < 0 || next.y >= HEIGHT) cost += 1000;
+            MECS_FOREACH_AT(&game->board, next.x, next.y, c) {
+                if (MECS_HAS_COMPONENT(game, collidable, c)) cost += 1000;
+            }
+            if (cost < best_cost) best_cost = cost, best = d;
+        }
+        game->direction[e] = best;
+    }
+}
+
+// Plays AI-steered games back to back until ticks updates have run, then
+// reports the tick rate and each system's average cost per tick.
+int run_headless(long ticks) {
+    if (ticks <= 0) {
+        fprintf(stderr, "usage: mecs_snake --headless [ticks]\n");
+        return 1;
+    }
+
+    const char* names[MECS_MAX_SYSTEMS] = { 0 };
+    uint64_t elapsed[MECS_MAX_SYSTEMS] = { 0 };
+    size_t system_count = 0;
+    long played = 0, games = 0, score = 0;
+
+    srand(1);
+    uint64_t start = clock_ns();
+    while (played < ticks) {
+        SnakeWorld* game = new_game();
+        game->systems.clock = clock_ns;
+        init_snake(game, 3);
+        place_edible(game, init_apple(game));
+
+        while (played < ticks) {
+            steer(game);
+            update_state(game);
+            ++played;
+            if (game_over(game)) break;
+        }
+
+        ++games;
+        score += game->score;
+        system_count = game->systems.count;
+        for (size_t i = 0; i < system_count; ++i) {
+            names[i] = game->systems.systems[i].name;
+            elapsed[i] += game->systems.systems[i].elapsed;
+        }
+        free_game(game);
+    }
+    double seconds = (double)(clock_ns() - start) / 1e9;
+
+    printf("%ld ticks in %.3f s (%.0f ticks/s), %ld games, %ld points\n",
+           played, seconds, (double)played / seconds, games, score);
+    for (size_t i = 0; i < system_count; ++i)
+        printf("  %-14s %10.1f ns/tick\n", names[i], (double)elapsed[i] / (double)played);
+    return 0;
+}
@@ -22,6 +22,9 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #ifndef MAX_ENTITIES
 #define MAX_ENTITIES 1024
@@ -29,52 +32,2466 @@
 
 typedef unsigned int Entity;
 
+#define MECS_INVALID_ENTITY ((Entity)-1)
+
+// A generation-tagged reference to an entity: the index in the low 32 bits
+// and the generation it was issued at in the high 32. Hold these across
+// frames and check them with mecs_entity_alive; index component arrays
+// with the plain Entity from mecs_handle_entity.
+typedef uint64_t EntityHandle;
+
+static inline Entity mecs_handle_entity(EntityHandle h) {
+    return (Entity)(h & 0xFFFFFFFFu);
+}
+
+static inline uint32_t mecs_handle_generation(EntityHandle h) {
+    return (uint32_t)(h >> 32);
+}
+
+// With MECS_DYNAMIC defined, per-entity arrays are heap pointers that grow
+// geometrically as mecs_entity_create hands out higher ids, instead of
+// being sized by MAX_ENTITIES. Every component must then be registered
+// with MECS_REGISTER_COMPONENT before use. Growth may move the arrays, so
+// do not hold component pointers across mecs_entity_create.
+#ifdef MECS_DYNAMIC
+#ifndef MECS_INITIAL_CAPACITY
+#define MECS_INITIAL_CAPACITY 64
+#endif
+#define MECS_ARRAY(Type, Name) Type *Name
+#else
+#define MECS_ARRAY(Type, Name) Type Name[MAX_ENTITIES]
+#endif
+
+// Presence of a component is one bit per entity, packed into 64-bit words.
+// A summary bitmap above it holds one bit per non-empty word, so a single
+// summary word answers for 4096 entities. The live count and, for sparse
+// components, the packed entity list let queries pick the cheapest
+// component to drive iteration.
+#define MECS_MASK_WORDS ((MAX_ENTITIES + 63) / 64)
+#define MECS_SUMMARY_WORDS ((MECS_MASK_WORDS + 63) / 64)
+
+struct MecsWatch;
+struct MecsChanges;
+struct MecsArchStore;
+
+typedef struct {
+#ifdef MECS_DYNAMIC
+    uint64_t *bits;
+    uint64_t *summary;
+    size_t words;
+#else
+    uint64_t bits[MECS_MASK_WORDS];
+    uint64_t summary[MECS_SUMMARY_WORDS];
+#endif
+    size_t count;
+    const Entity *packed;
+    struct MecsWatch *watchers;
+    struct MecsChanges *changes;
+    uint32_t version; // bumped when a relation's links change
+} MecsMask;
+
+static inline void mecs_watch_notify_(struct MecsWatch *watch, Entity e);
+static inline void mecs_watch_set_(struct MecsWatch *watch, Entity e);
+
+#ifdef MECS_DYNAMIC
+#define MECS_MASK_WORDS_OF(mask) ((mask)->words)
+#else
+#define MECS_MASK_WORDS_OF(mask) ((size_t)MECS_MASK_WORDS)
+#endif
+
+static inline unsigned mecs_ctz64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctzll(x);
+#else
+    unsigned n = 0;
+    while (!(x & 1)) x >>= 1, ++n;
+    return n;
+#endif
+}
+
+// Change tracking for a component, enabled with MECS_TRACK_CHANGES. ticks
+// holds the tick of each entity's last change and word_ticks the newest
+// tick in each 64-entity word. mask has a bit for every entity that holds
+// the component and has a recorded change, so change queries skip words
+// in which nothing was written, or nothing since the tick they ask about.
+typedef struct MecsChanges {
+    MECS_ARRAY(uint32_t, ticks);
+#ifdef MECS_DYNAMIC
+    uint32_t *word_ticks;
+#else
+    uint32_t word_ticks[MECS_MASK_WORDS];
+#endif
+    MecsMask mask;
+} MecsChanges;
+
+static inline bool mecs_mask_test(const MecsMask *mask, Entity e) {
+    return (mask->bits[e >> 6] >> (e & 63)) & 1;
+}
+
+static inline void mecs_mask_set(MecsMask *mask, Entity e) {
+    uint64_t bit = (uint64_t)1 << (e & 63);
+    if (!(mask->bits[e >> 6] & bit)) {
+        mask->bits[e >> 6] |= bit;
+        mask->summary[e >> 12] |= (uint64_t)1 << ((e >> 6) & 63);
+        mask->count++;
+        if (mask->watchers) mecs_watch_notify_(mask->watchers, e);
+    }
+}
+
+static inline void mecs_mask_clear(MecsMask *mask, Entity e) {
+    uint64_t bit = (uint64_t)1 << (e & 63);
+    if (mask->bits[e >> 6] & bit) {
+        if (!(mask->bits[e >> 6] &= ~bit))
+            mask->summary[e >> 12] &= ~((uint64_t)1 << ((e >> 6) & 63));
+        mask->count--;
+        if (mask->watchers) mecs_watch_notify_(mask->watchers, e);
+        if (mask->changes) mecs_mask_clear(&mask->changes->mask, e);
+    }
+}
+
+// Returns the first entity in [from, end) whose bit is set in every one of
+// the count masks and clear in every excluded mask, or MECS_INVALID_ENTITY.
+// The required summaries are ANDed first, so only words non-empty in
+// every required mask are loaded and a 4096-entity span empty in any of
+// them costs one test. Those words are combined 64 entities at a time.
+static inline Entity mecs_mask_next_excluding(const MecsMask *const *masks, size_t count,
+                                              const MecsMask *const *excluded, size_t excluded_count,
+                                              Entity from, Entity end) {
+    size_t words = ((size_t)end + 63) / 64;
+    for (size_t i = 0; i < count; ++i)
+        if (MECS_MASK_WORDS_OF(masks[i]) < words) words = MECS_MASK_WORDS_OF(masks[i]);
+
+    uint64_t keep = ~(uint64_t)0 << (from & 63);
+    size_t w = from >> 6;
+    while (w < words) {
+        size_t s = w >> 6;
+        uint64_t live = ~(uint64_t)0 << (w & 63);
+        for (size_t i = 0; i < count && live; ++i)
+            live &= masks[i]->summary[s];
+        if (!live) {
+            w = (s + 1) << 6;
+            keep = ~(uint64_t)0;
+            continue;
+        }
+        size_t next = (s << 6) + mecs_ctz64(live);
+        if (next != w) keep = ~(uint64_t)0;
+        w = next;
+        if (w >= words) break;
+
+        uint64_t bits = keep;
+        for (size_t i = 0; i < count && bits; ++i)
+            bits &= masks[i]->bits[w];
+        for (size_t i = 0; i < excluded_count && bits; ++i)
+            if (w < MECS_MASK_WORDS_OF(excluded[i])) bits &= ~excluded[i]->bits[w];
+        if (bits) {
+            Entity e = (Entity)(w * 64 + mecs_ctz64(bits));
+            return e < end ? e : MECS_INVALID_ENTITY;
+        }
+        ++w;
+        keep = ~(uint64_t)0;
+    }
+    return MECS_INVALID_ENTITY;
+}
+
+static inline Entity mecs_mask_next_all(const MecsMask *const *masks, size_t count, Entity from) {
+    return mecs_mask_next_excluding(masks, count, NULL, 0, from, MECS_INVALID_ENTITY);
+}
+
+static inline Entity mecs_mask_next(const MecsMask *mask, Entity from) {
+    return mecs_mask_next_all(&mask, 1, from);
+}
+
+static inline unsigned mecs_popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_popcountll(x);
+#else
+    unsigned n = 0;
+    for (; x; x &= x - 1) ++n;
+    return n;
+#endif
+}
+
+// The bits of word w that fall in [first, end).
+static inline uint64_t mecs_range_bits_(size_t w, size_t first, size_t end) {
+    size_t lo = w * 64;
+    uint64_t bits = ~(uint64_t)0;
+    if (first > lo) bits &= ~(uint64_t)0 << (first - lo);
+    if (end < lo + 64) bits &= ~(~(uint64_t)0 << (end - lo));
+    return bits;
+}
+
+// Range updates touch a word per 64 entities. They do not notify
+// watching queries; callers fall back to per-entity updates for those.
+static inline void mecs_mask_set_range_(MecsMask *mask, Entity first, size_t n) {
+    size_t end = (size_t)first + n;
+    for (size_t w = first >> 6; w < (end + 63) >> 6; ++w) {
+        uint64_t add = mecs_range_bits_(w, first, end) & ~mask->bits[w];
+        if (!add) continue;
+        mask->bits[w] |= add;
+        mask->summary[w >> 6] |= (uint64_t)1 << (w & 63);
+        mask->count += mecs_popcount64(add);
+    }
+}
+
+static inline void mecs_mask_clear_range_(MecsMask *mask, Entity first, size_t n) {
+    size_t end = (size_t)first + n;
+    for (size_t w = first >> 6; w < (end + 63) >> 6; ++w) {
+        uint64_t hit = mecs_range_bits_(w, first, end) & mask->bits[w];
+        if (!hit) continue;
+        if (!(mask->bits[w] &= ~hit))
+            mask->summary[w >> 6] &= ~((uint64_t)1 << (w & 63));
+        mask->count -= mecs_popcount64(hit);
+    }
+    if (mask->changes) mecs_mask_clear_range_(&mask->changes->mask, first, n);
+}
+
+// Sparse-set storage: values and their owners are kept packed in
+// Name##_dense / Name##_entities, with Name##_sparse mapping an entity to
+// its slot. Removal swaps the last slot into the hole.
+static inline size_t mecs_sparse_insert(MecsMask *mask, Entity *sparse, Entity *entities, Entity e) {
+    if (!mecs_mask_test(mask, e)) {
+        sparse[e] = (Entity)mask->count;
+        entities[mask->count] = e;
+        mask->packed = entities;
+        mecs_mask_set(mask, e);
+    }
+    return sparse[e];
+}
+
+static inline void mecs_sparse_remove(MecsMask *mask, Entity *sparse, Entity *entities,
+                                      void *dense, size_t size, Entity e) {
+    if (!mecs_mask_test(mask, e)) return;
+    mecs_mask_clear(mask, e);
+    size_t slot = sparse[e], last = mask->count;
+    if (slot != last) {
+        Entity moved = entities[last];
+        entities[slot] = moved;
+        sparse[moved] = (Entity)slot;
+        if (size) memcpy((char *)dense + slot * size, (char *)dense + last * size, size);
+    }
+}
+
 #define MECS_DEFINE_COMPONENT(CompType, Name) \
-    CompType Name[MAX_ENTITIES]; \
-    bool Name##_flag[MAX_ENTITIES]
+    MECS_ARRAY(CompType, Name); \
+    MecsMask Name##_mask
 
-#define MECS_HAS_COMPONENT(World, Name, e) ((World)->Name##_flag[(e)])
+#define MECS_DEFINE_SPARSE_COMPONENT(CompType, Name) \
+    MECS_ARRAY(CompType, Name##_dense); \
+    MECS_ARRAY(Entity, Name##_entities); \
+    MECS_ARRAY(Entity, Name##_sparse); \
+    MecsMask Name##_mask
+
+// A tag is a component with no data: only its presence mask is stored.
+// Use MECS_SET_TAG to add it; HAS, CLEAR and the queries work as usual.
+#define MECS_DEFINE_TAG(Name) \
+    MecsMask Name##_mask
+
+#define MECS_HAS_COMPONENT(World, Name, e) mecs_mask_test(&(World)->Name##_mask, (e))
 
 #define MECS_SET_COMPONENT(World, Name, e, Value) do { \
     (World)->Name[(e)] = (Value); \
-    (World)->Name##_flag[(e)] = true; \
+    mecs_mask_set(&(World)->Name##_mask, (e)); \
+    mecs_mark_changed(&(World)->em, &(World)->Name##_mask, (e)); \
+} while (0)
+
+// For values written in place rather than through MECS_SET_COMPONENT.
+#define MECS_MARK_CHANGED(World, Name, e) mecs_mark_changed(&(World)->em, &(World)->Name##_mask, (e))
+
+#define MECS_CLEAR_COMPONENT(World, Name, e) mecs_mask_clear(&(World)->Name##_mask, (e))
+
+#define MECS_SET_TAG(World, Name, e) mecs_mask_set(&(World)->Name##_mask, (e))
+
+#define MECS_GET_SPARSE_COMPONENT(World, Name, e) \
+    ((World)->Name##_dense[(World)->Name##_sparse[(e)]])
+
+#define MECS_SET_SPARSE_COMPONENT(World, Name, e, Value) do { \
+    size_t mecs_slot_ = mecs_sparse_insert(&(World)->Name##_mask, (World)->Name##_sparse, \
+                                           (World)->Name##_entities, (e)); \
+    (World)->Name##_dense[mecs_slot_] = (Value); \
+    mecs_mark_changed(&(World)->em, &(World)->Name##_mask, (e)); \
 } while (0)
 
-#define MECS_CLEAR_COMPONENT(World, Name, e) ((World)->Name##_flag[(e)] = false)
+#define MECS_CLEAR_SPARSE_COMPONENT(World, Name, e) \
+    mecs_sparse_remove(&(World)->Name##_mask, (World)->Name##_sparse, (World)->Name##_entities, \
+                       (World)->Name##_dense, sizeof((World)->Name##_dense[0]), (e))
+
+// Relations: a component whose value is another entity, the target, with
+// a reverse index so the entities relating to a target (its children) are
+// found in O(children). Name holds each source's target; Name##_links
+// threads the children of every target through an intrusive doubly linked
+// list. Links store id + 1 so zeroed storage means "none". Destroying a
+// target removes the relation from its children.
+typedef struct {
+    Entity first, next, prev;
+} MecsLinks;
+
+#define MECS_DEFINE_RELATION(Name) \
+    MECS_ARRAY(Entity, Name); \
+    MECS_ARRAY(MecsLinks, Name##_links); \
+    MecsMask Name##_mask
+
+static inline void mecs_relation_unlink_(const Entity *targets, MecsLinks *links, Entity e) {
+    MecsLinks *l = &links[e];
+    if (l->prev) links[l->prev - 1].next = l->next;
+    else links[targets[e]].first = l->next;
+    if (l->next) links[l->next - 1].prev = l->prev;
+    l->next = l->prev = 0;
+}
+
+static inline void mecs_relation_set(MecsMask *mask, Entity *targets, MecsLinks *links, Entity e, Entity target) {
+    if (mecs_mask_test(mask, e)) {
+        if (targets[e] == target) return;
+        mecs_relation_unlink_(targets, links, e);
+    }
+    targets[e] = target;
+    mask->version++;
+    links[e].prev = 0;
+    links[e].next = links[target].first;
+    if (links[target].first) links[links[target].first - 1].prev = e + 1;
+    links[target].first = e + 1;
+    mecs_mask_set(mask, e);
+}
+
+static inline void mecs_relation_remove(MecsMask *mask, Entity *targets, MecsLinks *links, Entity e) {
+    if (!mecs_mask_test(mask, e)) return;
+    mecs_relation_unlink_(targets, links, e);
+    mask->version++;
+    mecs_mask_clear(mask, e);
+}
+
+static inline void mecs_relation_orphan_(MecsMask *mask, Entity *targets, MecsLinks *links, Entity target) {
+    while (links[target].first) mecs_relation_remove(mask, targets, links, links[target].first - 1);
+}
+
+#define MECS_SET_RELATION(World, Name, e, Target) do { \
+    mecs_relation_set(&(World)->Name##_mask, (World)->Name, (World)->Name##_links, (e), (Target)); \
+    mecs_mark_changed(&(World)->em, &(World)->Name##_mask, (e)); \
+} while (0)
+
+#define MECS_GET_RELATION(World, Name, e) ((World)->Name[(e)])
+
+#define MECS_CLEAR_RELATION(World, Name, e) \
+    mecs_relation_remove(&(World)->Name##_mask, (World)->Name, (World)->Name##_links, (e))
+
+#define MECS_HAS_CHILDREN(World, Name, Target) ((World)->Name##_links[(Target)].first != 0)
+
+// The most recently added child of Target, or MECS_INVALID_ENTITY.
+#define MECS_FIRST_CHILD(World, Name, Target) ((World)->Name##_links[(Target)].first - 1)
+
+// Visits the entities whose Name relation targets Target, newest first.
+// The body may remove the relation from the current child.
+#define MECS_CHILD_NEXT_(World, Name, e) \
+    ((e) != MECS_INVALID_ENTITY ? (World)->Name##_links[(e)].next - 1 : MECS_INVALID_ENTITY)
+
+#define MECS_FOREACH_CHILD(World, Name, Target, e) \
+    for (Entity e = (World)->Name##_links[(Target)].first - 1, \
+                mecs_next_##e = MECS_CHILD_NEXT_(World, Name, e); \
+         e != MECS_INVALID_ENTITY; \
+         e = mecs_next_##e, mecs_next_##e = MECS_CHILD_NEXT_(World, Name, e))
+
+// A relation's sources in topological order: each entity comes after its
+// target, so one forward pass carries values from the roots down every
+// chain and a backward pass reaches children before their targets. The
+// order is rebuilt, without recursion, only when the relation's links
+// changed since the last update. Sources on a cycle are left out.
+typedef struct {
+    Entity *order;
+    size_t count, capacity;
+    uint32_t version;
+} MecsHierarchy;
+
+static inline void mecs_hierarchy_update(MecsHierarchy *h, const MecsMask *mask, const Entity *targets,
+                                         const MecsLinks *links) {
+    if (h->version == mask->version) return;
+    if (h->capacity < mask->count) {
+        h->capacity = mask->count;
+        h->order = realloc(h->order, h->capacity * sizeof(Entity));
+        if (!h->order) abort();
+    }
+    // Roots relate to an entity outside the relation; breadth-first from
+    // them each source is appended once, after its target.
+    size_t n = 0;
+    for (Entity e = mecs_mask_next(mask, 0); e != MECS_INVALID_ENTITY; e = mecs_mask_next(mask, e + 1))
+        if (!mecs_mask_test(mask, targets[e])) h->order[n++] = e;
+    for (size_t i = 0; i < n; ++i)
+        for (Entity c = links[h->order[i]].first; c; c = links[c - 1].next) h->order[n++] = c - 1;
+    h->count = n;
+    h->version = mask->version;
+}
+
+static inline void mecs_hierarchy_free(MecsHierarchy *h) {
+    free(h->order);
+    memset(h, 0, sizeof(*h));
+}
+
+#define MECS_HIERARCHY_UPDATE(World, Name, H) \
+    mecs_hierarchy_update((H), &(World)->Name##_mask, (World)->Name, (World)->Name##_links)
+
+// Visits the hierarchy's entities, targets before their children.
+#define MECS_FOREACH_TOPDOWN(H, e) \
+    for (size_t mecs_i_##e = 0, mecs_once_##e = 1; mecs_once_##e; mecs_once_##e = 0) \
+        for (Entity e; mecs_i_##e < (H)->count && (e = (H)->order[mecs_i_##e], 1); ++mecs_i_##e)
+
+// Visits the hierarchy's entities, children before their targets.
+#define MECS_FOREACH_BOTTOMUP(H, e) \
+    for (size_t mecs_i_##e = (H)->count, mecs_once_##e = 1; mecs_once_##e; mecs_once_##e = 0) \
+        for (Entity e; mecs_i_##e > 0 && (e = (H)->order[mecs_i_##e - 1], 1); --mecs_i_##e)
+
+// Query state behind MECS_FOREACH_*. When a sparse component takes part,
+// the smallest packed entity list drives iteration (back to front, so the
+// body may remove the current entity) and the other masks are probed.
+// Otherwise the masks are intersected word by word.
+#ifndef MECS_QUERY_MAX
+#define MECS_QUERY_MAX 8
+#endif
+
+typedef enum { MECS_TERM_WITH, MECS_TERM_WITHOUT, MECS_TERM_OPTIONAL, MECS_TERM_CHANGED } MecsTermKind;
+
+typedef struct {
+    const MecsMask *mask;
+    MecsTermKind kind;
+    uint32_t since;
+} MecsTerm;
+
+typedef struct {
+    const MecsMask *mask;
+    const MecsChanges *changes;
+    uint32_t since;
+} MecsChangedTerm;
+
+typedef struct {
+    const MecsMask *terms[MECS_QUERY_MAX];
+    size_t count;
+    const MecsMask *excluded[MECS_QUERY_MAX];
+    size_t excluded_count;
+    MecsChangedTerm changed[MECS_QUERY_MAX];
+    size_t changed_count;
+    const MecsMask *driver;
+    const Entity *end;
+    size_t cursor;
+    bool once;
+} MecsQuery;
+
+// Required terms are ordered by live count so the sparsest mask is tested
+// first and the intersection of a word usually stops after one load. A
+// query with an empty required term finishes without scanning. Optional
+// terms never filter; they only document what the body may touch. A
+// changed term requires the component and is driven by its change mask,
+// skipping words with no tick newer than the term's since and checking
+// each remaining candidate's tick. Word scans stop at *end, the world's
+// live high-water mark.
+static inline MecsQuery mecs_query_init(const MecsTerm *terms, size_t count, const Entity *end) {
+    MecsQuery q = { .end = end, .once = true };
+    for (size_t i = 0; i < count; ++i) {
+        const MecsMask *m = terms[i].mask;
+        if (terms[i].kind == MECS_TERM_WITHOUT) q.excluded[q.excluded_count++] = m;
+        if (terms[i].kind == MECS_TERM_CHANGED) {
+            if (!m->changes) abort();
+            q.changed[q.changed_count++] = (MecsChangedTerm){ m, m->changes, terms[i].since };
+            m = &m->changes->mask;
+        } else if (terms[i].kind != MECS_TERM_WITH) {
+            continue;
+        }
+
+        size_t j = q.count++;
+        for (; j > 0 && q.terms[j - 1]->count > m->count; --j)
+            q.terms[j] = q.terms[j - 1];
+        q.terms[j] = m;
+        if (m->packed && (!q.driver || m->count < q.driver->count))
+            q.driver = m;
+    }
+    if (q.count && q.terms[0]->count == 0) {
+        q.driver = NULL;
+        q.cursor = MECS_INVALID_ENTITY;
+    } else if (q.driver) {
+        q.cursor = q.driver->count;
+    }
+    return q;
+}
+
+// Whether no entity in e's word changed after some changed term's since.
+static inline bool mecs_query_stale_word_(const MecsQuery *q, Entity e) {
+    for (size_t i = 0; i < q->changed_count; ++i)
+        if (q->changed[i].changes->word_ticks[e >> 6] <= q->changed[i].since) return true;
+    return false;
+}
+
+static inline bool mecs_query_changed_(const MecsQuery *q, Entity e) {
+    for (size_t i = 0; i < q->changed_count; ++i) {
+        const MecsChangedTerm *c = &q->changed[i];
+        if (!mecs_mask_test(c->mask, e) || c->changes->ticks[e] <= c->since) return false;
+    }
+    return true;
+}
+
+static inline Entity mecs_query_next(MecsQuery *q) {
+    if (!q->driver) {
+        Entity e;
+        do {
+            e = mecs_mask_next_excluding(q->terms, q->count, q->excluded, q->excluded_count,
+                                         (Entity)q->cursor, *q->end);
+            if (e == MECS_INVALID_ENTITY) q->cursor = e;
+            else q->cursor = mecs_query_stale_word_(q, e) ? ((size_t)e | 63) + 1 : (size_t)e + 1;
+        } while (e != MECS_INVALID_ENTITY && !mecs_query_changed_(q, e));
+        return e;
+    }
+    if (q->cursor > q->driver->count) q->cursor = q->driver->count;
+    while (q->cursor > 0) {
+        Entity e = q->driver->packed[--q->cursor];
+        size_t i = 0, j = 0;
+        while (i < q->count && mecs_mask_test(q->terms[i], e)) ++i;
+        while (i == q->count && j < q->excluded_count && !mecs_mask_test(q->excluded[j], e)) ++j;
+        if (i == q->count && j == q->excluded_count && mecs_query_changed_(q, e)) return e;
+    }
+    return MECS_INVALID_ENTITY;
+}
+
+#define MECS_TERM_LIST_(...) \
+    (const MecsTerm[]){ __VA_ARGS__ }, sizeof((const MecsTerm[]){ __VA_ARGS__ }) / sizeof(MecsTerm)
+
+#define MECS_FOREACH_TERMS_(World, e, ...) \
+    for (MecsQuery mecs_q_##e = mecs_query_init(MECS_TERM_LIST_(__VA_ARGS__), &(World)->em.high_water); \
+         mecs_q_##e.once; mecs_q_##e.once = false) \
+        for (Entity e = mecs_query_next(&mecs_q_##e); e != MECS_INVALID_ENTITY; \
+             e = mecs_query_next(&mecs_q_##e))
+
+#define MECS_NARGS_(...) MECS_NARGS_IMPL_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define MECS_NARGS_IMPL_(_1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+#define MECS_CAT_(a, b) MECS_CAT_IMPL_(a, b)
+#define MECS_CAT_IMPL_(a, b) a##b
+#define MECS_SECOND_(a, b, ...) b
+#define MECS_UNWRAP_(...) __VA_ARGS__
+#define MECS_APPLY_(m, args) m args
+
+// Query terms are component names, or MECS_WITHOUT(name) / MECS_OPTIONAL(name)
+// / MECS_CHANGED(name, since). The wrappers expand to a parenthesised
+// (kind, name, since) triple that MECS_TERM_ tells apart from a bare name.
+// MECS_CHANGED matches entities whose tracked component changed after
+// tick since (see mecs_tick); since 0 matches every recorded change.
+#define MECS_WITHOUT(Name) (MECS_TERM_WITHOUT, Name, 0)
+#define MECS_OPTIONAL(Name) (MECS_TERM_OPTIONAL, Name, 0)
+#define MECS_CHANGED(Name, Since) (MECS_TERM_CHANGED, Name, Since)
+
+#define MECS_IS_PAREN_(x) MECS_IS_PAREN_CHECK_(MECS_IS_PAREN_PROBE_ x)
+#define MECS_IS_PAREN_PROBE_(...) ~, 1
+#define MECS_IS_PAREN_CHECK_(...) MECS_SECOND_(__VA_ARGS__, 0, ~)
+
+#define MECS_TERM_(W, T) MECS_CAT_(MECS_TERM_IMPL_, MECS_IS_PAREN_(T))(W, T)
+#define MECS_TERM_IMPL_0(W, C) { &(W)->C##_mask, MECS_TERM_WITH, 0 }
+#define MECS_TERM_IMPL_1(W, T) MECS_APPLY_(MECS_TERM_KIND_, (W, MECS_UNWRAP_ T))
+#define MECS_TERM_KIND_(W, Kind, C, Since) { &(W)->C##_mask, Kind, (Since) }
+
+#define MECS_TERMS_1_(W, T) MECS_TERM_(W, T)
+#define MECS_TERMS_2_(W, T, ...) MECS_TERM_(W, T), MECS_TERMS_1_(W, __VA_ARGS__)
+#define MECS_TERMS_3_(W, T, ...) MECS_TERM_(W, T), MECS_TERMS_2_(W, __VA_ARGS__)
+#define MECS_TERMS_4_(W, T, ...) MECS_TERM_(W, T), MECS_TERMS_3_(W, __VA_ARGS__)
+#define MECS_TERMS_5_(W, T, ...) MECS_TERM_(W, T), MECS_TERMS_4_(W, __VA_ARGS__)
+#define MECS_TERMS_6_(W, T, ...) MECS_TERM_(W, T), MECS_TERMS_5_(W, __VA_ARGS__)
+#define MECS_TERMS_7_(W, T, ...) MECS_TERM_(W, T), MECS_TERMS_6_(W, __VA_ARGS__)
+#define MECS_TERMS_8_(W, T, ...) MECS_TERM_(W, T), MECS_TERMS_7_(W, __VA_ARGS__)
+#define MECS_TERMS_(W, ...) MECS_CAT_(MECS_TERMS_, MECS_CAT_(MECS_NARGS_(__VA_ARGS__), _))(W, __VA_ARGS__)
+
+// Iterates entities holding every listed component (up to 8 terms, at
+// least one of them required). Only entities created through the world's
+// EntityManager `em` are visited.
+#define MECS_FOREACH(World, e, ...) \
+    MECS_FOREACH_TERMS_(World, e, MECS_TERMS_(World, __VA_ARGS__))
+
+#define MECS_FOREACH_1(World, C1, e) MECS_FOREACH(World, e, C1)
+#define MECS_FOREACH_2(World, C1, C2, e) MECS_FOREACH(World, e, C1, C2)
+#define MECS_FOREACH_3(World, C1, C2, C3, e) MECS_FOREACH(World, e, C1, C2, C3)
+
+#ifndef MECS_MAX_COMPONENTS
+#define MECS_MAX_COMPONENTS 32
+#endif
+
+// Registered components. The column fields reference the component's
+// arrays: the array itself in fixed mode, the address of its pointer
+// member in dynamic mode (read either with mecs_column_). Tags have no
+// values; sparse components also fill in entities and sparse, relations
+// fill in links. Masks owned by the library (such as cached query
+// membership) are registered as derived: they grow with the world but
+// whole-entity operations skip them.
+typedef struct {
+    const char *name;
+    MecsMask *mask;
+    void *values;
+    void *entities;
+    void *sparse;
+    void *links;
+    size_t size;
+    bool derived;
+} MecsComponentInfo;
 
-#define MECS_FOREACH_1(World, C1, e) \
-    for (Entity e = 0; e < MAX_ENTITIES; ++e) \
-        if ((World)->C1##_flag[e])
+static inline void *mecs_column_(void *ref) {
+#ifdef MECS_DYNAMIC
+    void *data = NULL;
+    if (ref) memcpy(&data, ref, sizeof(data));
+    return data;
+#else
+    return ref;
+#endif
+}
 
-#define MECS_FOREACH_2(World, C1, C2, e) \
-    for (Entity e = 0; e < MAX_ENTITIES; ++e) \
-        if ((World)->C1##_flag[e] && \
-            (World)->C2##_flag[e])
+#ifdef MECS_DYNAMIC
+#define MECS_COLUMN_REF_(Array) ((void *)&(Array))
+#else
+#define MECS_COLUMN_REF_(Array) ((void *)(Array))
+#endif
 
-#define MECS_FOREACH_3(World, C1, C2, C3, e) \
-    for (Entity e = 0; e < MAX_ENTITIES; ++e) \
-        if ((World)->C1##_flag[e] && \
-            (World)->C2##_flag[e] && \
-            (World)->C3##_flag[e])
+#ifdef MECS_DYNAMIC
+// A per-entity array owned by the world: the address of its pointer
+// member and the element size.
+typedef struct {
+    void *ref;
+    size_t size;
+} MecsColumn;
+#endif
 
+// next_entity is the next never-used id; high_water is one past the
+// highest live entity and bounds every query scan. alive has a bit per
+// live entity.
 typedef struct {
     Entity next_entity;
-    Entity free_list[MAX_ENTITIES];
+    Entity high_water;
+    uint32_t tick;
+    MecsMask alive;
+    MECS_ARRAY(Entity, free_list);
+    MECS_ARRAY(uint32_t, generations);
     size_t free_count;
+    MecsComponentInfo components[MECS_MAX_COMPONENTS];
+    size_t component_count;
+    struct MecsObserver *observers;
+    struct MecsArchStore *arch; // archetype store cleared along with the registry
+#ifdef MECS_DYNAMIC
+    size_t capacity;
+    MecsColumn columns[MECS_MAX_COMPONENTS * 3 + 1];
+    size_t column_count;
+#endif
 } EntityManager;
 
+#ifdef MECS_DYNAMIC
+// Resizes the array behind ref from old to capacity elements, zeroing the
+// new tail. The pointer is moved through memcpy since ref points at a
+// member of arbitrary pointer type.
+static inline void mecs_column_resize_(void *ref, size_t size, size_t old, size_t capacity) {
+    char *data;
+    memcpy(&data, ref, sizeof(data));
+    data = realloc(data, capacity * size);
+    if (!data) abort();
+    memset(data + old * size, 0, (capacity - old) * size);
+    memcpy(ref, &data, sizeof(data));
+}
+
+static inline void mecs_mask_resize_(MecsMask *mask, size_t capacity) {
+    size_t words = (capacity + 63) / 64;
+    size_t summary_words = (words + 63) / 64, old_summary = (mask->words + 63) / 64;
+    mask->bits = realloc(mask->bits, words * sizeof(uint64_t));
+    mask->summary = realloc(mask->summary, summary_words * sizeof(uint64_t));
+    if (!mask->bits || !mask->summary) abort();
+    memset(mask->bits + mask->words, 0, (words - mask->words) * sizeof(uint64_t));
+    memset(mask->summary + old_summary, 0, (summary_words - old_summary) * sizeof(uint64_t));
+    mask->words = words;
+}
+
+static inline void mecs_mask_release_(MecsMask *mask) {
+    free(mask->bits);
+    free(mask->summary);
+    mask->bits = mask->summary = NULL;
+    mask->words = 0;
+}
+
+static inline void mecs_grow_(EntityManager *em, size_t capacity) {
+    mecs_mask_resize_(&em->alive, capacity);
+    mecs_column_resize_(&em->free_list, sizeof(Entity), em->capacity, capacity);
+    mecs_column_resize_(&em->generations, sizeof(uint32_t), em->capacity, capacity);
+    for (size_t i = 0; i < em->column_count; ++i)
+        mecs_column_resize_(em->columns[i].ref, em->columns[i].size, em->capacity, capacity);
+    for (size_t i = 0; i < em->component_count; ++i) {
+        MecsComponentInfo *c = &em->components[i];
+        mecs_mask_resize_(c->mask, capacity);
+        if (c->entities && c->mask->packed) c->mask->packed = mecs_column_(c->entities);
+        if (c->mask->changes)
+            mecs_column_resize_(&c->mask->changes->word_ticks, sizeof(uint32_t), (em->capacity + 63) / 64,
+                                (capacity + 63) / 64);
+    }
+    em->capacity = capacity;
+}
+
+static inline void mecs_register_column(EntityManager *em, void *ref, size_t size) {
+    if (em->column_count >= sizeof(em->columns) / sizeof(em->columns[0])) abort();
+    em->columns[em->column_count].ref = ref;
+    em->columns[em->column_count++].size = size;
+    if (em->capacity) mecs_column_resize_(ref, size, 0, em->capacity);
+}
+
+// Forgets a mask and/or column registered for storage the caller is about
+// to release.
+static inline void mecs_unregister_(EntityManager *em, MecsMask *mask, void *ref) {
+    for (size_t i = 0; i < em->component_count; ++i)
+        if (em->components[i].mask == mask)
+            em->components[i--] = em->components[--em->component_count];
+    for (size_t i = 0; i < em->column_count; ++i)
+        if (em->columns[i].ref == ref)
+            em->columns[i--] = em->columns[--em->column_count];
+}
+
+#define MECS_REGISTER_COLUMN_(World, Array) \
+    mecs_register_column(&(World)->em, &(Array), sizeof(*(Array)))
+#else
+#define MECS_REGISTER_COLUMN_(World, Array) ((void)0)
+#endif
+
+static inline size_t mecs_capacity(const EntityManager *em) {
+#ifdef MECS_DYNAMIC
+    return em->capacity;
+#else
+    (void)em;
+    return MAX_ENTITIES;
+#endif
+}
+
+static inline void mecs_register_component(EntityManager *em, MecsComponentInfo info) {
+    if (em->component_count >= MECS_MAX_COMPONENTS) abort();
+    em->components[em->component_count++] = info;
+#ifdef MECS_DYNAMIC
+    if (em->capacity) mecs_mask_resize_(info.mask, em->capacity);
+    if (info.values) mecs_register_column(em, info.values, info.size);
+    if (info.entities) {
+        mecs_register_column(em, info.entities, sizeof(Entity));
+        mecs_register_column(em, info.sparse, sizeof(Entity));
+    }
+    if (info.links) mecs_register_column(em, info.links, sizeof(MecsLinks));
+#endif
+}
+
+// Registration is required in dynamic mode and lets the EntityManager
+// see every component of the world in both modes.
+#define MECS_REGISTER_COMPONENT(World, Name) \
+    mecs_register_component(&(World)->em, (MecsComponentInfo){ .name = #Name, \
+        .mask = &(World)->Name##_mask, .values = MECS_COLUMN_REF_((World)->Name), \
+        .size = sizeof(*(World)->Name) })
+
+#define MECS_REGISTER_TAG(World, Name) \
+    mecs_register_component(&(World)->em, (MecsComponentInfo){ .name = #Name, \
+        .mask = &(World)->Name##_mask })
+
+#define MECS_REGISTER_SPARSE_COMPONENT(World, Name) \
+    mecs_register_component(&(World)->em, (MecsComponentInfo){ .name = #Name, \
+        .mask = &(World)->Name##_mask, .values = MECS_COLUMN_REF_((World)->Name##_dense), \
+        .entities = MECS_COLUMN_REF_((World)->Name##_entities), \
+        .sparse = MECS_COLUMN_REF_((World)->Name##_sparse), .size = sizeof(*(World)->Name##_dense) })
+
+#define MECS_REGISTER_RELATION(World, Name) \
+    mecs_register_component(&(World)->em, (MecsComponentInfo){ .name = #Name, \
+        .mask = &(World)->Name##_mask, .values = MECS_COLUMN_REF_((World)->Name), \
+        .links = MECS_COLUMN_REF_((World)->Name##_links), .size = sizeof(Entity) })
+
+// A world can be declared from a single component list instead of
+// matching MECS_DEFINE_* and MECS_REGISTER_* lines by hand. The list takes
+// four macros and calls C(Type, Name) for each component, S(Type, Name)
+// for each sparse component, T(Name) for each tag and R(Name) for each
+// relation:
+//
+//     #define GAME_COMPONENTS(C, S, T, R) C(Position, position) S(Edible, edible) T(player) R(parent)
+//
+//     typedef struct {
+//         EntityManager em;
+//         MECS_WORLD_COMPONENTS(GAME_COMPONENTS)
+//     } Game;
+//     MECS_DEFINE_WORLD_REGISTER(Game, GAME_COMPONENTS)
+//
+// The second macro defines mecs_register_Game(Game *), which registers the
+// whole list, after which the mecs_entity_* whole-entity operations cover
+// every component.
+#define MECS_WORLD_FIELD_C_(Type, Name) MECS_DEFINE_COMPONENT(Type, Name);
+#define MECS_WORLD_FIELD_S_(Type, Name) MECS_DEFINE_SPARSE_COMPONENT(Type, Name);
+#define MECS_WORLD_FIELD_T_(Name) MECS_DEFINE_TAG(Name);
+#define MECS_WORLD_FIELD_R_(Name) MECS_DEFINE_RELATION(Name);
+#define MECS_WORLD_REGISTER_C_(Type, Name) MECS_REGISTER_COMPONENT(mecs_world_, Name);
+#define MECS_WORLD_REGISTER_S_(Type, Name) MECS_REGISTER_SPARSE_COMPONENT(mecs_world_, Name);
+#define MECS_WORLD_REGISTER_T_(Name) MECS_REGISTER_TAG(mecs_world_, Name);
+#define MECS_WORLD_REGISTER_R_(Name) MECS_REGISTER_RELATION(mecs_world_, Name);
+
+#define MECS_WORLD_COMPONENTS(List) \
+    List(MECS_WORLD_FIELD_C_, MECS_WORLD_FIELD_S_, MECS_WORLD_FIELD_T_, MECS_WORLD_FIELD_R_)
+
+#define MECS_DEFINE_WORLD_REGISTER(WorldType, List) \
+    static inline void mecs_register_##WorldType(WorldType *mecs_world_) { \
+        List(MECS_WORLD_REGISTER_C_, MECS_WORLD_REGISTER_S_, MECS_WORLD_REGISTER_T_, MECS_WORLD_REGISTER_R_) \
+    }
+
+// Releases storage allocated for a dynamic world; a no-op otherwise.
+static inline void mecs_storage_free(EntityManager *em) {
+#ifdef MECS_DYNAMIC
+    for (size_t i = 0; i < em->column_count; ++i) {
+        void *data;
+        memcpy(&data, em->columns[i].ref, sizeof(data));
+        free(data);
+        memset(em->columns[i].ref, 0, sizeof(data));
+    }
+    for (size_t i = 0; i < em->component_count; ++i)
+        mecs_mask_release_(em->components[i].mask);
+    mecs_mask_release_(&em->alive);
+    free(em->free_list);
+    free(em->generations);
+    em->free_list = NULL;
+    em->generations = NULL;
+    em->capacity = 0;
+#endif
+    for (size_t i = 0; i < em->component_count; ++i) {
+        MecsMask *mask = em->components[i].mask;
+        if (em->components[i].derived || !mask->changes) continue;
+#ifdef MECS_DYNAMIC
+        free(mask->changes->word_ticks);
+#endif
+        free(mask->changes);
+        mask->changes = NULL;
+    }
+}
+
+// Change tracking. Each tracked component stamps an entity with the
+// current tick when it is set; MECS_CHANGED query terms compare stamps
+// with a tick returned by mecs_tick. A system that wants every change
+// since its last run keeps `since = mecs_tick(em)` from the end of that
+// run. Tracking state is freed by mecs_storage_free.
+static inline void mecs_track_changes(EntityManager *em, MecsMask *mask) {
+    if (mask->changes) return;
+    mask->changes = calloc(1, sizeof(MecsChanges));
+    if (!mask->changes) abort();
+#ifdef MECS_DYNAMIC
+    mecs_register_component(em, (MecsComponentInfo){ .mask = &mask->changes->mask,
+                                                      .values = &mask->changes->ticks,
+                                                      .size = sizeof(uint32_t), .derived = true });
+    if (em->capacity)
+        mecs_column_resize_(&mask->changes->word_ticks, sizeof(uint32_t), 0, (em->capacity + 63) / 64);
+#else
+    (void)em;
+#endif
+}
+
+#define MECS_TRACK_CHANGES(World, Name) mecs_track_changes(&(World)->em, &(World)->Name##_mask)
+
+#ifdef MECS_THREADS
+// Value writes may come from parallel query callbacks, whose chunks share
+// summary words and counts, so what they update is locked or atomic.
+static inline void mecs_spin_lock_(bool *lock) {
+    while (__atomic_test_and_set(lock, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {}
+}
+
+static inline void mecs_spin_unlock_(bool *lock) {
+    __atomic_clear(lock, __ATOMIC_RELEASE);
+}
+
+static inline void mecs_mask_set_atomic_(MecsMask *mask, Entity e) {
+    uint64_t bit = (uint64_t)1 << (e & 63);
+    if (__atomic_fetch_or(&mask->bits[e >> 6], bit, __ATOMIC_RELAXED) & bit) return;
+    __atomic_fetch_or(&mask->summary[e >> 12], (uint64_t)1 << ((e >> 6) & 63), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&mask->count, 1, __ATOMIC_RELAXED);
+}
+#endif
+
+// Called whenever a component value is written: stamps tracked
+// components and queues on_set for observers.
+static inline void mecs_mark_changed(const EntityManager *em, MecsMask *mask, Entity e) {
+    MecsChanges *c = mask->changes;
+    if (mask->watchers) mecs_watch_set_(mask->watchers, e);
+    if (!c) return;
+    c->ticks[e] = em->tick + 1;
+#ifdef MECS_THREADS
+    __atomic_store_n(&c->word_ticks[e >> 6], em->tick + 1, __ATOMIC_RELAXED);
+    mecs_mask_set_atomic_(&c->mask, e);
+#else
+    c->word_ticks[e >> 6] = em->tick + 1;
+    mecs_mask_set(&c->mask, e);
+#endif
+}
+
+// Ends the current tick and returns it. Changes recorded from now on are
+// newer than the returned value.
+static inline uint32_t mecs_tick(EntityManager *em) {
+    return ++em->tick;
+}
+
+static inline bool mecs_entity_exists(const EntityManager *em, Entity e) {
+    return e < em->next_entity && mecs_mask_test(&em->alive, e);
+}
+
+// Per-entity removal and write through the registry, for every kind of
+// component storage. A relation write naming a target that is not alive
+// is dropped.
+static inline void mecs_component_remove_(MecsComponentInfo *c, Entity e) {
+    if (c->entities)
+        mecs_sparse_remove(c->mask, mecs_column_(c->sparse), mecs_column_(c->entities),
+                           mecs_column_(c->values), c->size, e);
+    else if (c->links)
+        mecs_relation_remove(c->mask, mecs_column_(c->values), mecs_column_(c->links), e);
+    else
+        mecs_mask_clear(c->mask, e);
+}
+
+static inline void mecs_component_write_(const EntityManager *em, MecsComponentInfo *c, Entity e,
+                                         const void *value) {
+    char *values = mecs_column_(c->values);
+    if (c->entities) {
+        size_t slot = mecs_sparse_insert(c->mask, mecs_column_(c->sparse), mecs_column_(c->entities), e);
+        memcpy(values + slot * c->size, value, c->size);
+    } else if (c->links) {
+        Entity target;
+        memcpy(&target, value, sizeof(target));
+        if (!mecs_entity_exists(em, target)) return;
+        mecs_relation_set(c->mask, (Entity *)values, mecs_column_(c->links), e, target);
+    } else {
+        if (values) memcpy(values + e * c->size, value, c->size);
+        mecs_mask_set(c->mask, e);
+    }
+    if (values) mecs_mark_changed(em, c->mask, e);
+}
+
+static inline void mecs_arch_destroy(struct MecsArchStore *s, Entity e);
+static inline void mecs_arch_copy(struct MecsArchStore *s, Entity dst, Entity src);
+static inline size_t mecs_arch_memory(const struct MecsArchStore *s, size_t capacity);
+
+// Removes every registered component from [first, first + n). Plain masks
+// are cleared a word at a time; sparse lists, relations and watched masks
+// are walked per set bit so their indices and queries stay consistent.
+// Entities also leave a registered archetype store.
+static inline void mecs_components_clear_range_(EntityManager *em, Entity first, size_t n) {
+    size_t end = (size_t)first + n;
+    for (size_t i = 0; i < em->component_count; ++i) {
+        MecsComponentInfo *c = &em->components[i];
+        MecsMask *m = c->mask;
+        if (c->derived) continue;
+        if (!c->entities && !c->links && !m->watchers) {
+            mecs_mask_clear_range_(m, first, n);
+            continue;
+        }
+        for (size_t w = first >> 6; w < (end + 63) >> 6; ++w)
+            for (uint64_t hit = mecs_range_bits_(w, first, end) & m->bits[w]; hit; hit &= hit - 1)
+                mecs_component_remove_(c, (Entity)(w * 64 + mecs_ctz64(hit)));
+    }
+    if (em->arch)
+        for (size_t e = first; e < end; ++e) mecs_arch_destroy(em->arch, (Entity)e);
+}
+
+// Entities about to be destroyed stop being relation targets.
+static inline void mecs_relations_orphan_range_(EntityManager *em, Entity first, size_t n) {
+    for (size_t i = 0; i < em->component_count; ++i) {
+        MecsComponentInfo *c = &em->components[i];
+        if (!c->links) continue;
+        MecsLinks *links = mecs_column_(c->links);
+        for (size_t e = first; e < (size_t)first + n; ++e)
+            if (links[e].first) mecs_relation_orphan_(c->mask, mecs_column_(c->values), links, (Entity)e);
+    }
+}
+
+// Grows a dynamic world so ids below capacity need no further growth; a
+// no-op in fixed mode.
+static inline void mecs_entity_reserve(EntityManager *em, size_t capacity) {
+#ifdef MECS_DYNAMIC
+    size_t grown = em->capacity ? em->capacity : MECS_INITIAL_CAPACITY;
+    while (grown < capacity) grown *= 2;
+    if (grown != em->capacity) mecs_grow_(em, grown);
+#else
+    (void)em;
+    (void)capacity;
+#endif
+}
+
 static inline Entity mecs_entity_create(EntityManager *em) {
+    Entity e;
     if (em->free_count > 0) {
-        return em->free_list[--em->free_count];
+        e = em->free_list[--em->free_count];
     } else {
-        return em->next_entity++;
+#ifdef MECS_DYNAMIC
+        if (em->next_entity >= em->capacity)
+            mecs_grow_(em, em->capacity ? em->capacity * 2 : MECS_INITIAL_CAPACITY);
+#else
+        if (em->next_entity >= MAX_ENTITIES) return MECS_INVALID_ENTITY;
+#endif
+        e = em->next_entity++;
+    }
+    mecs_mask_set(&em->alive, e);
+    if (e >= em->high_water) em->high_water = e + 1;
+    return e;
+}
+
+// Lowers high_water past trailing dead entities, a word at a time.
+static inline void mecs_high_water_drop_(EntityManager *em) {
+    size_t w = ((size_t)em->high_water + 63) / 64;
+    while (w > 0 && !em->alive.bits[w - 1]) --w;
+    Entity top = 0;
+    if (w > 0) {
+        uint64_t bits = em->alive.bits[w - 1];
+        top = (Entity)((w - 1) * 64);
+        while (bits >>= 1) ++top;
+        ++top;
     }
+    em->high_water = top;
 }
 
+// Destroying an entity also removes its registered components.
 static inline void mecs_entity_destroy(EntityManager *em, Entity e) {
-    if (em->free_count < MAX_ENTITIES) {
+    if (!mecs_entity_exists(em, e)) return;
+    mecs_relations_orphan_range_(em, e, 1);
+    mecs_components_clear_range_(em, e, 1);
+    mecs_mask_clear(&em->alive, e);
+    em->generations[e]++;
+    em->free_list[em->free_count++] = e;
+    if (e + 1 == em->high_water) mecs_high_water_drop_(em);
+}
+
+// True when the top n free-list entries are the ascending run that
+// mecs_entity_destroy_n pushes.
+static inline bool mecs_free_run_(const EntityManager *em, size_t n) {
+    if (em->free_count < n) return false;
+    Entity first = em->free_list[em->free_count - 1];
+    for (size_t i = 1; i < n; ++i)
+        if (em->free_list[em->free_count - 1 - i] != first + i) return false;
+    return true;
+}
+
+// Allocates n contiguous ids and returns the first, or MECS_INVALID_ENTITY
+// when a fixed-capacity world has no room. A run freed by the last
+// mecs_entity_destroy_n of the same size is reused; otherwise the ids come
+// from the never-used range.
+static inline Entity mecs_entity_create_n(EntityManager *em, size_t n) {
+    Entity first;
+    if (n == 0) return MECS_INVALID_ENTITY;
+    if (mecs_free_run_(em, n)) {
+        first = em->free_list[em->free_count - 1];
+        em->free_count -= n;
+    } else {
+        size_t end = (size_t)em->next_entity + n;
+#ifdef MECS_DYNAMIC
+        mecs_entity_reserve(em, end);
+#else
+        if (end > MAX_ENTITIES) return MECS_INVALID_ENTITY;
+#endif
+        first = em->next_entity;
+        em->next_entity = (Entity)end;
+    }
+    mecs_mask_set_range_(&em->alive, first, n);
+    if (first + n > em->high_water) em->high_water = (Entity)(first + n);
+    return first;
+}
+
+// Returns ids above high_water to the never-used range, so bulk churn at
+// the top of the id space does not keep raising next_entity.
+static inline void mecs_trim_(EntityManager *em) {
+    if (em->high_water == em->next_entity) return;
+    em->next_entity = em->high_water;
+    size_t kept = 0;
+    for (size_t i = 0; i < em->free_count; ++i)
+        if (em->free_list[i] < em->next_entity) em->free_list[kept++] = em->free_list[i];
+    em->free_count = kept;
+}
+
+// Destroys every live entity in [first, first + n) and clears their
+// registered components with bulk word operations.
+static inline void mecs_entity_destroy_n(EntityManager *em, Entity first, size_t n) {
+    if (first >= em->next_entity) return;
+    if (n > em->next_entity - first) n = em->next_entity - first;
+    mecs_relations_orphan_range_(em, first, n);
+    mecs_components_clear_range_(em, first, n);
+    for (size_t i = n; i-- > 0;) {
+        Entity e = first + (Entity)i;
+        if (!mecs_mask_test(&em->alive, e)) continue;
+        em->generations[e]++;
         em->free_list[em->free_count++] = e;
     }
+    mecs_mask_clear_range_(&em->alive, first, n);
+    if ((size_t)first + n >= em->high_water) {
+        mecs_high_water_drop_(em);
+        mecs_trim_(em);
+    }
+}
+
+// Removes every registered component from e, keeping the entity alive.
+static inline void mecs_entity_clear(EntityManager *em, Entity e) {
+    if (mecs_entity_exists(em, e)) mecs_components_clear_range_(em, e, 1);
+}
+
+// Copies each registered component src has onto dst, replacing dst's
+// value where it already has one. Components src lacks are left alone.
+// A registered archetype store copies its row the same way.
+static inline void mecs_entity_copy(EntityManager *em, Entity dst, Entity src) {
+    if (dst == src || !mecs_entity_exists(em, dst) || !mecs_entity_exists(em, src)) return;
+    for (size_t i = 0; i < em->component_count; ++i) {
+        MecsComponentInfo *c = &em->components[i];
+        char *values = mecs_column_(c->values);
+        if (c->derived || !mecs_mask_test(c->mask, src)) continue;
+        size_t slot = c->entities ? ((Entity *)mecs_column_(c->sparse))[src] : src;
+        mecs_component_write_(em, c, dst, values ? values + slot * c->size : NULL);
+    }
+    if (em->arch) mecs_arch_copy(em->arch, dst, src);
+}
+
+// Creates an entity carrying a copy of every registered component of src.
+static inline Entity mecs_entity_clone(EntityManager *em, Entity src) {
+    if (!mecs_entity_exists(em, src)) return MECS_INVALID_ENTITY;
+    Entity e = mecs_entity_create(em);
+    mecs_entity_copy(em, e, src);
+    return e;
+}
+
+// Destroys every entity, leaving registrations and storage in place.
+static inline void mecs_clear(EntityManager *em) {
+    mecs_entity_destroy_n(em, 0, em->next_entity);
+}
+
+// Bytes of storage behind a registered component: its presence mask and,
+// where present, its value and sparse-set columns.
+static inline size_t mecs_component_memory(const EntityManager *em, const MecsComponentInfo *c) {
+    size_t words = MECS_MASK_WORDS_OF(c->mask);
+    size_t bytes = (words + (words + 63) / 64) * sizeof(uint64_t);
+    if (c->values) bytes += mecs_capacity(em) * c->size;
+    if (c->entities) bytes += 2 * mecs_capacity(em) * sizeof(Entity);
+    if (c->links) bytes += mecs_capacity(em) * sizeof(MecsLinks);
+#ifndef MECS_DYNAMIC
+    if (c->mask->changes) bytes += sizeof(MecsChanges); // registered separately when dynamic
+#else
+    if (c->mask->changes) bytes += (mecs_capacity(em) + 63) / 64 * sizeof(uint32_t);
+#endif
+    return bytes;
+}
+
+// Bytes of storage behind the EntityManager and everything registered
+// with it, including cached query membership and archetype chunks.
+static inline size_t mecs_memory_usage(const EntityManager *em) {
+    size_t words = MECS_MASK_WORDS_OF(&em->alive);
+    size_t bytes = (words + (words + 63) / 64) * sizeof(uint64_t);
+    bytes += mecs_capacity(em) * (sizeof(Entity) + sizeof(uint32_t));
+    for (size_t i = 0; i < em->component_count; ++i)
+        bytes += mecs_component_memory(em, &em->components[i]);
+    if (em->arch) bytes += mecs_arch_memory(em->arch, mecs_capacity(em));
+    return bytes;
+}
+
+static inline EntityHandle mecs_entity_handle(const EntityManager *em, Entity e) {
+    return (EntityHandle)em->generations[e] << 32 | e;
+}
+
+// O(1): a handle is alive while its entity exists and has not been
+// destroyed since the handle was made, even if the index has since been
+// recycled for a new entity.
+static inline bool mecs_entity_alive(const EntityManager *em, EntityHandle h) {
+    Entity e = mecs_handle_entity(h);
+    return mecs_entity_exists(em, e) && em->generations[e] == mecs_handle_generation(h);
+}
+
+// Cached queries keep a packed list of the entities matching their terms.
+// Each term's mask links back to the query, so every membership change
+// made through the component macros updates the list in O(1) and
+// iteration is a walk over a contiguous array. A cached query lives next
+// to the world it watches and must be released with
+// mecs_cached_query_free if it is dropped before the world.
+// A mask's watchers are told about every change to it: cached queries
+// update their membership and grids re-bucket the entity at once,
+// observers queue an event.
+typedef enum { MECS_EVENT_ADD, MECS_EVENT_REMOVE, MECS_EVENT_SET } MecsEventKind;
+
+typedef struct MecsWatch {
+    struct MecsCachedQuery *query;
+    struct MecsObserver *observer;
+    struct MecsGrid *grid;
+    MecsMask *mask;
+    struct MecsWatch *next;
+} MecsWatch;
+
+typedef struct MecsCachedQuery {
+    MecsQuery terms;
+    MecsMask members;
+    MECS_ARRAY(Entity, entities);
+    MECS_ARRAY(Entity, slots);
+    MecsWatch watches[2 * MECS_QUERY_MAX];
+    size_t watch_count;
+} MecsCachedQuery;
+
+static inline bool mecs_query_matches(const MecsQuery *q, Entity e) {
+    for (size_t i = 0; i < q->count; ++i)
+        if (!mecs_mask_test(q->terms[i], e)) return false;
+    for (size_t i = 0; i < q->excluded_count; ++i)
+        if (mecs_mask_test(q->excluded[i], e)) return false;
+    return true;
+}
+
+static inline void mecs_cached_query_update_(MecsCachedQuery *q, Entity e) {
+    if (mecs_query_matches(&q->terms, e))
+        mecs_sparse_insert(&q->members, q->slots, q->entities, e);
+    else
+        mecs_sparse_remove(&q->members, q->slots, q->entities, NULL, 0, e);
+}
+
+static inline void mecs_observer_log_(struct MecsObserver *obs, Entity e, MecsEventKind kind);
+static inline void mecs_grid_update_(struct MecsGrid *g, Entity e);
+
+static inline void mecs_watch_notify_(MecsWatch *watch, Entity e) {
+    for (; watch; watch = watch->next) {
+        if (watch->observer)
+            mecs_observer_log_(watch->observer, e,
+                               mecs_mask_test(watch->mask, e) ? MECS_EVENT_ADD : MECS_EVENT_REMOVE);
+        else if (watch->grid)
+            mecs_grid_update_(watch->grid, e);
+        else
+            mecs_cached_query_update_(watch->query, e);
+    }
+}
+
+static inline void mecs_watch_set_(MecsWatch *watch, Entity e) {
+    for (; watch; watch = watch->next) {
+        if (watch->observer) mecs_observer_log_(watch->observer, e, MECS_EVENT_SET);
+        else if (watch->grid) mecs_grid_update_(watch->grid, e);
+    }
+}
+
+static inline void mecs_cached_query_watch_(MecsCachedQuery *q, const MecsMask *mask) {
+    MecsWatch *w = &q->watches[q->watch_count++];
+    w->query = q;
+    w->mask = (MecsMask *)mask;
+    w->next = w->mask->watchers;
+    w->mask->watchers = w;
 }
 
+static inline void mecs_cached_query_init(EntityManager *em, MecsCachedQuery *q,
+                                          const MecsTerm *terms, size_t count) {
+    memset(q, 0, sizeof(*q));
+    q->terms = mecs_query_init(terms, count, &em->high_water);
+    if (q->terms.changed_count) abort(); // membership cannot follow ticks
+#ifdef MECS_DYNAMIC
+    mecs_register_component(em, (MecsComponentInfo){ .mask = &q->members, .entities = &q->entities,
+                                                      .sparse = &q->slots, .derived = true });
+#endif
+    MecsQuery scan = q->terms;
+    for (Entity e = mecs_query_next(&scan); e != MECS_INVALID_ENTITY; e = mecs_query_next(&scan))
+        mecs_sparse_insert(&q->members, q->slots, q->entities, e);
+
+    for (size_t i = 0; i < q->terms.count; ++i) mecs_cached_query_watch_(q, q->terms.terms[i]);
+    for (size_t i = 0; i < q->terms.excluded_count; ++i) mecs_cached_query_watch_(q, q->terms.excluded[i]);
+}
+
+static inline void mecs_cached_query_free(EntityManager *em, MecsCachedQuery *q) {
+    for (size_t i = 0; i < q->watch_count; ++i) {
+        MecsWatch **link = &q->watches[i].mask->watchers;
+        while (*link && *link != &q->watches[i]) link = &(*link)->next;
+        if (*link) *link = (*link)->next;
+    }
+    q->watch_count = 0;
+#ifdef MECS_DYNAMIC
+    mecs_unregister_(em, &q->members, &q->entities);
+    mecs_unregister_(em, NULL, &q->slots);
+    mecs_mask_release_(&q->members);
+    free(q->entities);
+    free(q->slots);
+    memset(&q->members, 0, sizeof(q->members));
+    q->entities = q->slots = NULL;
+#else
+    (void)em;
+#endif
+}
+
+// Walks the packed member list back to front, so the body may remove the
+// current entity from the query.
+static inline bool mecs_cached_query_next(const MecsCachedQuery *q, size_t *cursor, Entity *e) {
+    if (*cursor > q->members.count) *cursor = q->members.count;
+    if (*cursor == 0) return false;
+    *e = q->entities[--*cursor];
+    return true;
+}
+
+#define MECS_CACHED_QUERY_INIT(World, Query, ...) \
+    mecs_cached_query_init(&(World)->em, (Query), MECS_TERM_LIST_(MECS_TERMS_(World, __VA_ARGS__)))
+
+#define MECS_FOREACH_CACHED(Query, e) \
+    for (size_t mecs_cursor_##e = (Query)->members.count, mecs_once_##e = 1; mecs_once_##e; \
+         mecs_once_##e = 0) \
+        for (Entity e = 0; mecs_cached_query_next((Query), &mecs_cursor_##e, &e);)
+
+// Observers. A MecsObserver attached to a component queues an event when
+// the component is added to or removed from an entity, or its value is
+// set (through the SET macros, command buffers or MECS_MARK_CHANGED).
+// Nothing runs inline: mecs_observers_flush delivers each observer's
+// events in the order they happened, calling on_add, on_remove or on_set
+// with the observer's ctx, so derived indices can be maintained
+// incrementally at sync points. Callbacks see the world as it is at the
+// flush and may change components; events they cause are delivered in
+// the same flush. Any callback may be NULL.
+typedef void (*MecsObserverFn)(void *ctx, Entity e);
+
+typedef struct {
+    Entity entity;
+    MecsEventKind kind;
+} MecsEvent;
+
+typedef struct MecsObserver {
+    MecsObserverFn on_add, on_remove, on_set;
+    void *ctx;
+    MecsWatch watch;
+    MecsEvent *events;
+    size_t event_count, event_capacity;
+    struct MecsObserver *next;
+#ifdef MECS_THREADS
+    bool lock;
+#endif
+} MecsObserver;
+
+static inline MecsObserverFn mecs_observer_fn_(const MecsObserver *obs, MecsEventKind kind) {
+    return kind == MECS_EVENT_ADD ? obs->on_add : kind == MECS_EVENT_REMOVE ? obs->on_remove : obs->on_set;
+}
+
+static inline void mecs_observer_log_(MecsObserver *obs, Entity e, MecsEventKind kind) {
+    if (!mecs_observer_fn_(obs, kind)) return;
+#ifdef MECS_THREADS
+    mecs_spin_lock_(&obs->lock);
+#endif
+    if (obs->event_count == obs->event_capacity) {
+        obs->event_capacity = obs->event_capacity ? obs->event_capacity * 2 : 64;
+        obs->events = realloc(obs->events, obs->event_capacity * sizeof(MecsEvent));
+        if (!obs->events) abort();
+    }
+    obs->events[obs->event_count++] = (MecsEvent){ e, kind };
+#ifdef MECS_THREADS
+    mecs_spin_unlock_(&obs->lock);
+#endif
+}
+
+static inline void mecs_observe(EntityManager *em, MecsObserver *obs, MecsMask *mask, MecsObserverFn on_add,
+                                MecsObserverFn on_remove, MecsObserverFn on_set, void *ctx) {
+    memset(obs, 0, sizeof(*obs));
+    obs->on_add = on_add;
+    obs->on_remove = on_remove;
+    obs->on_set = on_set;
+    obs->ctx = ctx;
+    obs->watch = (MecsWatch){ .observer = obs, .mask = mask, .next = mask->watchers };
+    mask->watchers = &obs->watch;
+    obs->next = em->observers;
+    em->observers = obs;
+}
+
+#define MECS_OBSERVE(World, Observer, Name, OnAdd, OnRemove, OnSet, Ctx) \
+    mecs_observe(&(World)->em, (Observer), &(World)->Name##_mask, (OnAdd), (OnRemove), (OnSet), (Ctx))
+
+static inline void mecs_observers_flush(EntityManager *em) {
+    for (bool pending = true; pending;) {
+        pending = false;
+        for (MecsObserver *obs = em->observers; obs; obs = obs->next) {
+            pending |= obs->event_count > 0;
+            for (size_t i = 0; i < obs->event_count; ++i) {
+                MecsEvent ev = obs->events[i];
+                mecs_observer_fn_(obs, ev.kind)(obs->ctx, ev.entity);
+            }
+            obs->event_count = 0;
+        }
+    }
+}
+
+static inline void mecs_observer_free(EntityManager *em, MecsObserver *obs) {
+    MecsWatch **link = &obs->watch.mask->watchers;
+    while (*link && *link != &obs->watch) link = &(*link)->next;
+    if (*link) *link = obs->watch.next;
+    MecsObserver **node = &em->observers;
+    while (*node && *node != obs) node = &(*node)->next;
+    if (*node) *node = obs->next;
+    free(obs->events);
+    memset(obs, 0, sizeof(*obs));
+}
+
+// Spatial index. A MecsGrid buckets the entities of a dense component
+// holding two int coordinates into square cells of a fixed-size board
+// with its corner at (0, 0), so finding what sits at or near a point
+// costs a walk over a few cells instead of a scan. It follows the
+// component as it changes: adds, removes and sets (through the SET
+// macros, command buffers or MECS_MARK_CHANGED) move the entity between
+// cells at once. Entities positioned off the board are not indexed.
+// The grid also keeps the set of empty cells as a packed array with a
+// slot per cell, so a uniformly random empty cell is one index away.
+typedef struct {
+    Entity next, prev; // id + 1 within the cell, 0 for none
+    uint32_t cell; // cell index + 1, 0 when not indexed
+} MecsGridLinks;
+
+typedef struct MecsGrid {
+    MecsWatch watch;
+    void *values;
+    size_t size, x_offset, y_offset;
+    int width, height, cell_size; // board size in cells; cell edge in units
+    Entity *cells; // first entity id + 1 per cell
+    uint32_t *empty, *empty_slot; // packed empty cells; each cell's index in empty
+    size_t empty_count;
+    MECS_ARRAY(MecsGridLinks, links);
+#ifdef MECS_THREADS
+    bool lock;
+#endif
+} MecsGrid;
+
+static inline void mecs_grid_position_(const MecsGrid *g, Entity e, int *x, int *y) {
+    const char *value = (const char *)mecs_column_(g->values) + (size_t)e * g->size;
+    memcpy(x, value + g->x_offset, sizeof(int));
+    memcpy(y, value + g->y_offset, sizeof(int));
+}
+
+static inline int mecs_grid_cell_of_(const MecsGrid *g, int v) {
+    return v < 0 ? -1 : v / g->cell_size;
+}
+
+// Swap-removes a cell that gained its first entity from the empty set, or
+// appends one that lost its last.
+static inline void mecs_grid_fill_(MecsGrid *g, uint32_t cell) {
+    uint32_t slot = g->empty_slot[cell], last = g->empty[--g->empty_count];
+    g->empty[slot] = last;
+    g->empty_slot[last] = slot;
+}
+
+static inline void mecs_grid_vacate_(MecsGrid *g, uint32_t cell) {
+    g->empty_slot[cell] = (uint32_t)g->empty_count;
+    g->empty[g->empty_count++] = cell;
+}
+
+// Moves e from its current cell to cell (both index + 1, 0 for none).
+static inline void mecs_grid_move_(MecsGrid *g, Entity e, uint32_t cell) {
+    MecsGridLinks *l = &g->links[e];
+    if (l->cell) {
+        if (l->prev) g->links[l->prev - 1].next = l->next;
+        else g->cells[l->cell - 1] = l->next;
+        if (l->next) g->links[l->next - 1].prev = l->prev;
+        if (!g->cells[l->cell - 1]) mecs_grid_vacate_(g, l->cell - 1);
+    }
+    l->cell = cell;
+    l->prev = 0;
+    if (!cell) return;
+    l->next = g->cells[cell - 1];
+    if (!l->next) mecs_grid_fill_(g, cell - 1);
+    if (l->next) g->links[l->next - 1].prev = e + 1;
+    g->cells[cell - 1] = e + 1;
+}
+
+static inline void mecs_grid_update_(MecsGrid *g, Entity e) {
+    uint32_t cell = 0;
+    if (mecs_mask_test(g->watch.mask, e)) {
+        int x, y;
+        mecs_grid_position_(g, e, &x, &y);
+        int cx = mecs_grid_cell_of_(g, x), cy = mecs_grid_cell_of_(g, y);
+        if (cx >= 0 && cx < g->width && cy >= 0 && cy < g->height) cell = (uint32_t)(cy * g->width + cx) + 1;
+    }
+#ifdef MECS_THREADS
+    mecs_spin_lock_(&g->lock);
+#endif
+    if (g->links[e].cell != cell) mecs_grid_move_(g, e, cell);
+#ifdef MECS_THREADS
+    mecs_spin_unlock_(&g->lock);
+#endif
+}
+
+static inline void mecs_grid_init(EntityManager *em, MecsGrid *g, MecsMask *mask, void *values, size_t size,
+                                  size_t x_offset, size_t y_offset, int width, int height, int cell_size) {
+    if (width <= 0 || height <= 0 || cell_size <= 0) abort();
+    memset(g, 0, sizeof(*g));
+    g->values = values;
+    g->size = size;
+    g->x_offset = x_offset;
+    g->y_offset = y_offset;
+    g->width = width;
+    g->height = height;
+    g->cell_size = cell_size;
+    size_t cells = (size_t)width * (size_t)height;
+    if (cells > UINT32_MAX) abort();
+    g->cells = calloc(cells, sizeof(Entity));
+    g->empty = malloc(cells * sizeof(uint32_t));
+    g->empty_slot = malloc(cells * sizeof(uint32_t));
+    if (!g->cells || !g->empty || !g->empty_slot) abort();
+    for (uint32_t i = 0; i < cells; ++i) g->empty[i] = g->empty_slot[i] = i;
+    g->empty_count = cells;
+#ifdef MECS_DYNAMIC
+    mecs_register_column(em, &g->links, sizeof(MecsGridLinks));
+#else
+    (void)em;
+#endif
+    g->watch.grid = g;
+    g->watch.mask = mask;
+    for (Entity e = mecs_mask_next(mask, 0); e != MECS_INVALID_ENTITY; e = mecs_mask_next(mask, e + 1))
+        mecs_grid_update_(g, e);
+    g->watch.next = mask->watchers;
+    mask->watchers = &g->watch;
+}
+
+static inline void mecs_grid_free(EntityManager *em, MecsGrid *g) {
+    MecsWatch **link = &g->watch.mask->watchers;
+    while (*link && *link != &g->watch) link = &(*link)->next;
+    if (*link) *link = g->watch.next;
+#ifdef MECS_DYNAMIC
+    mecs_unregister_(em, NULL, &g->links);
+    free(g->links);
+#else
+    (void)em;
+#endif
+    free(g->cells);
+    free(g->empty);
+    free(g->empty_slot);
+    memset(g, 0, sizeof(*g));
+}
+
+// The corner of the i-th empty cell, for i below g->empty_count. The
+// order is arbitrary but a uniform i picks a uniform empty cell.
+static inline void mecs_grid_empty_cell(const MecsGrid *g, size_t i, int *x, int *y) {
+    uint32_t cell = g->empty[i];
+    *x = (int)(cell % (uint32_t)g->width) * g->cell_size;
+    *y = (int)(cell / (uint32_t)g->width) * g->cell_size;
+}
+
+// Walks the entities whose position lies in the square [x0, x1] x
+// [y0, y1], cell by cell. The next candidate is read before an entity is
+// returned, so the caller may move or remove the current one.
+typedef struct {
+    const MecsGrid *grid;
+    int x0, y0, x1, y1;
+    int cx, cy, cx0, cx1, cy1;
+    Entity next;
+} MecsGridCursor;
+
+static inline MecsGridCursor mecs_grid_near(const MecsGrid *g, int x, int y, int radius) {
+    MecsGridCursor c = { g, x - radius, y - radius, x + radius, y + radius, 0, 0, 0, 0, 0, 0 };
+    int cx0 = mecs_grid_cell_of_(g, c.x0), cy0 = mecs_grid_cell_of_(g, c.y0);
+    c.cx0 = cx0 < 0 ? 0 : cx0;
+    c.cx1 = mecs_grid_cell_of_(g, c.x1) < g->width - 1 ? mecs_grid_cell_of_(g, c.x1) : g->width - 1;
+    c.cy1 = mecs_grid_cell_of_(g, c.y1) < g->height - 1 ? mecs_grid_cell_of_(g, c.y1) : g->height - 1;
+    c.cx = c.cx0 - 1;
+    c.cy = cy0 < 0 ? 0 : cy0;
+    if (c.cx1 < c.cx0) c.cy = c.cy1 + 1; // no cell on the board
+    return c;
+}
+
+static inline bool mecs_grid_next(MecsGridCursor *c, Entity *out) {
+    const MecsGrid *g = c->grid;
+    for (;;) {
+        while (!c->next) {
+            if (c->cy > c->cy1) return false;
+            if (++c->cx > c->cx1) {
+                c->cx = c->cx0 - 1;
+                ++c->cy;
+                continue;
+            }
+            c->next = g->cells[c->cy * g->width + c->cx];
+        }
+        Entity e = c->next - 1;
+        int x, y;
+        c->next = g->links[e].next;
+        mecs_grid_position_(g, e, &x, &y);
+        if (x >= c->x0 && x <= c->x1 && y >= c->y0 && y <= c->y1) {
+            *out = e;
+            return true;
+        }
+    }
+}
+
+// Position fields X and Y of Type must be int.
+#define MECS_GRID_INIT(World, Grid, Type, Name, X, Y, Width, Height, CellSize) \
+    mecs_grid_init(&(World)->em, (Grid), &(World)->Name##_mask, MECS_COLUMN_REF_((World)->Name), sizeof(Type), \
+                   offsetof(Type, X), offsetof(Type, Y), (Width), (Height), (CellSize))
+
+#define MECS_FOREACH_NEAR(Grid, X, Y, Radius, e) \
+    for (MecsGridCursor mecs_cursor_##e = mecs_grid_near((Grid), (X), (Y), (Radius)); \
+         mecs_cursor_##e.grid; mecs_cursor_##e.grid = NULL) \
+        for (Entity e; mecs_grid_next(&mecs_cursor_##e, &e);)
+
+#define MECS_FOREACH_AT(Grid, X, Y, e) MECS_FOREACH_NEAR(Grid, X, Y, 0, e)
+
+// Deferred structural changes. Systems record creates, destroys, sets and
+// clears into a MecsCommandBuffer while iterating and apply them with
+// mecs_cmd_flush at a sync point, so no query sees its storage change
+// underneath it. Values are copied into the buffer when recorded. A flush
+// creates entities first, then applies sets and clears grouped by
+// component and sorted by entity (recording order breaks ties), then
+// destroys. Set and clear target registered components only.
+typedef enum { MECS_CMD_SET, MECS_CMD_CLEAR, MECS_CMD_DESTROY } MecsCommandKind;
+
+typedef struct {
+    MecsCommandKind kind;
+    Entity entity;
+    const MecsMask *mask;
+    size_t component;
+    size_t offset;
+    size_t size;
+    size_t seq;
+} MecsCommand;
+
+typedef struct {
+    MecsCommand *commands;
+    size_t count, capacity;
+    unsigned char *data;
+    size_t data_size, data_capacity;
+    Entity *pending;
+    size_t pending_count, pending_capacity;
+} MecsCommandBuffer;
+
+// mecs_cmd_create hands out placeholder ids counting down from just below
+// MECS_INVALID_ENTITY; a flush maps them to the entities it creates.
+#define MECS_CMD_PENDING_(k) ((Entity)(MECS_INVALID_ENTITY - 1 - (Entity)(k)))
+
+static inline void *mecs_cmd_reserve_(void *data, size_t *capacity, size_t needed, size_t size) {
+    if (data && needed <= *capacity) return data;
+    size_t grown = *capacity ? *capacity : 16;
+    while (grown < needed) grown *= 2;
+    data = realloc(data, grown * size);
+    if (!data) abort();
+    *capacity = grown;
+    return data;
+}
+
+// Records a command and returns room for its size-byte value.
+static inline void *mecs_cmd_push_(MecsCommandBuffer *cb, MecsCommandKind kind, const MecsMask *mask,
+                                   Entity e, size_t size) {
+    cb->commands = mecs_cmd_reserve_(cb->commands, &cb->capacity, cb->count + 1, sizeof(MecsCommand));
+    cb->data = mecs_cmd_reserve_(cb->data, &cb->data_capacity, cb->data_size + size, 1);
+    cb->commands[cb->count] = (MecsCommand){ .kind = kind, .entity = e, .mask = mask,
+                                             .offset = cb->data_size, .size = size, .seq = cb->count };
+    cb->count++;
+    cb->data_size += size;
+    return cb->data + cb->data_size - size;
+}
+
+static inline Entity mecs_cmd_create(MecsCommandBuffer *cb) {
+    return MECS_CMD_PENDING_(cb->pending_count++);
+}
+
+static inline void mecs_cmd_destroy(MecsCommandBuffer *cb, Entity e) {
+    mecs_cmd_push_(cb, MECS_CMD_DESTROY, NULL, e, 0);
+}
+
+#define MECS_CMD_SET(Commands, World, CompType, Name, e, Value) do { \
+    CompType mecs_value_ = (Value); \
+    memcpy(mecs_cmd_push_((Commands), MECS_CMD_SET, &(World)->Name##_mask, (e), sizeof(CompType)), \
+           &mecs_value_, sizeof(CompType)); \
+} while (0)
+
+#define MECS_CMD_SET_TAG(Commands, World, Name, e) \
+    ((void)mecs_cmd_push_((Commands), MECS_CMD_SET, &(World)->Name##_mask, (e), 0))
+
+// Clears a component or a tag, sparse or not.
+#define MECS_CMD_CLEAR(Commands, World, Name, e) \
+    ((void)mecs_cmd_push_((Commands), MECS_CMD_CLEAR, &(World)->Name##_mask, (e), 0))
+
+static inline int mecs_cmd_compare_(const void *a, const void *b) {
+    const MecsCommand *x = a, *y = b;
+    if ((x->kind == MECS_CMD_DESTROY) != (y->kind == MECS_CMD_DESTROY))
+        return x->kind == MECS_CMD_DESTROY ? 1 : -1;
+    if (x->component != y->component) return x->component < y->component ? -1 : 1;
+    if (x->entity != y->entity) return x->entity < y->entity ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static inline void mecs_cmd_apply_(EntityManager *em, const MecsCommandBuffer *cb, const MecsCommand *cmd) {
+    Entity e = cmd->entity;
+    if (!mecs_entity_exists(em, e)) return;
+    if (cmd->kind == MECS_CMD_DESTROY) {
+        mecs_entity_destroy(em, e);
+        return;
+    }
+
+    MecsComponentInfo *c = &em->components[cmd->component];
+    if (cmd->kind == MECS_CMD_CLEAR)
+        mecs_component_remove_(c, e);
+    else
+        mecs_component_write_(em, c, e, cb->data ? cb->data + cmd->offset : NULL);
+}
+
+// The entity a placeholder from mecs_cmd_create stands for once the
+// flush has created it; other ids are returned unchanged.
+static inline Entity mecs_cmd_resolve_(const MecsCommandBuffer *cb, Entity e) {
+    Entity k = MECS_INVALID_ENTITY - 1 - e;
+    return e != MECS_INVALID_ENTITY && k < cb->pending_count ? cb->pending[k] : e;
+}
+
+// Applies and forgets every recorded command. Commands naming a component
+// that is not registered with em, or setting a value whose size differs
+// from the component's, abort; commands on entities that are no longer
+// alive are dropped. Placeholders are resolved both as the entity a
+// command acts on and as the target of a relation set.
+static inline void mecs_cmd_flush(EntityManager *em, MecsCommandBuffer *cb) {
+    cb->pending = mecs_cmd_reserve_(cb->pending, &cb->pending_capacity, cb->pending_count, sizeof(Entity));
+    for (size_t k = 0; k < cb->pending_count; ++k) cb->pending[k] = mecs_entity_create(em);
+    for (size_t i = 0; i < cb->count; ++i) {
+        MecsCommand *cmd = &cb->commands[i];
+        cmd->entity = mecs_cmd_resolve_(cb, cmd->entity);
+        if (cmd->kind == MECS_CMD_DESTROY) continue;
+        for (cmd->component = 0; cmd->component < em->component_count; ++cmd->component)
+            if (em->components[cmd->component].mask == cmd->mask) break;
+        if (cmd->component == em->component_count) abort();
+        if (cmd->kind == MECS_CMD_SET && cmd->size != em->components[cmd->component].size) abort();
+        if (cmd->kind == MECS_CMD_SET && em->components[cmd->component].links) {
+            Entity target;
+            memcpy(&target, cb->data + cmd->offset, sizeof(target));
+            target = mecs_cmd_resolve_(cb, target);
+            memcpy(cb->data + cmd->offset, &target, sizeof(target));
+        }
+    }
+    if (cb->count) qsort(cb->commands, cb->count, sizeof(MecsCommand), mecs_cmd_compare_);
+    for (size_t i = 0; i < cb->count; ++i) mecs_cmd_apply_(em, cb, &cb->commands[i]);
+    cb->count = cb->data_size = cb->pending_count = 0;
+}
+
+static inline void mecs_cmd_free(MecsCommandBuffer *cb) {
+    free(cb->commands);
+    free(cb->data);
+    free(cb->pending);
+    memset(cb, 0, sizeof(*cb));
+}
+
+// Parallel queries, enabled by defining MECS_THREADS (link with pthreads;
+// GCC or Clang atomics are required). A MecsThreadPool keeps its workers
+// alive between queries. MECS_PARALLEL_FOREACH splits [0, high_water) into
+// chunks of MECS_PARALLEL_CHUNK entities, a multiple of 64 so no presence
+// mask word is shared between threads, gives each participant a contiguous
+// run of chunks and lets it steal from the others' runs once its own is
+// done. Fn(ctx, e, worker) is called once per matching entity, with worker
+// in [0, thread_count] (the caller takes part as the last worker), so it
+// can record structural changes into a per-worker MecsCommandBuffer. Fn
+// must not change component sets itself. It may write the current
+// entity's values, tracked, observed or grid-indexed ones included:
+// change stamps are atomic and observer logs and grids take a lock, so
+// the events of one parallel query are logged in no fixed order, and a
+// grid must not be queried while a parallel query writes to it.
+#ifdef MECS_THREADS
+#include <pthread.h>
+
+#if !defined(__GNUC__) && !defined(__clang__)
+#error "MECS_THREADS requires GCC or Clang atomic builtins"
+#endif
+
+#ifndef MECS_MAX_THREADS
+#define MECS_MAX_THREADS 64
+#endif
+
+#ifndef MECS_PARALLEL_CHUNK
+#define MECS_PARALLEL_CHUNK 1024
+#endif
+
+#if MECS_PARALLEL_CHUNK % 64
+#error "MECS_PARALLEL_CHUNK must be a multiple of 64"
+#endif
+
+typedef void (*MecsEntityFn)(void *ctx, Entity e, size_t worker);
+
+// A participant's run of chunks. next is claimed atomically by its owner
+// and by thieves; the padding keeps runs on separate cache lines.
+typedef struct {
+    size_t next, end;
+    char pad[64 - 2 * sizeof(size_t)];
+} MecsWorkRange;
+
+struct MecsThreadPool;
+
+typedef struct {
+    struct MecsThreadPool *pool;
+    size_t index;
+} MecsWorker;
+
+typedef struct MecsThreadPool {
+    pthread_t threads[MECS_MAX_THREADS];
+    MecsWorker workers[MECS_MAX_THREADS];
+    size_t thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t wake, done;
+    unsigned long job;
+    size_t active;
+    bool stop;
+    void (*task)(struct MecsThreadPool *pool, size_t worker);
+    void *task_ctx;
+
+    const MecsQuery *query;
+    Entity end;
+    MecsEntityFn fn;
+    void *ctx;
+    MecsWorkRange ranges[MECS_MAX_THREADS + 1];
+    size_t range_count;
+} MecsThreadPool;
+
+static inline void mecs_parallel_run_(MecsThreadPool *pool, size_t worker) {
+    const MecsQuery *q = pool->query;
+    for (size_t k = 0; k < pool->range_count; ++k) {
+        MecsWorkRange *r = &pool->ranges[(worker + k) % pool->range_count];
+        for (;;) {
+            size_t chunk = __atomic_fetch_add(&r->next, 1, __ATOMIC_RELAXED);
+            if (chunk >= r->end) break;
+            Entity e = (Entity)(chunk * MECS_PARALLEL_CHUNK);
+            Entity end = pool->end - e > MECS_PARALLEL_CHUNK ? e + MECS_PARALLEL_CHUNK : pool->end;
+            while ((e = mecs_mask_next_excluding(q->terms, q->count, q->excluded, q->excluded_count,
+                                                 e, end)) != MECS_INVALID_ENTITY) {
+                if (mecs_query_changed_(q, e)) pool->fn(pool->ctx, e, worker);
+                e = mecs_query_stale_word_(q, e) ? (e | 63) + 1 : e + 1;
+            }
+        }
+    }
+}
+
+static inline void *mecs_worker_main_(void *arg) {
+    MecsWorker *w = arg;
+    MecsThreadPool *pool = w->pool;
+    unsigned long seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->job == seen && !pool->stop) pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->job;
+        pthread_mutex_unlock(&pool->lock);
+
+        pool->task(pool, w->index);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0) pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// Starts thread_count workers; the calling thread makes one more.
+static inline void mecs_thread_pool_init(MecsThreadPool *pool, size_t thread_count) {
+    memset(pool, 0, sizeof(*pool));
+    if (thread_count > MECS_MAX_THREADS) thread_count = MECS_MAX_THREADS;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (size_t i = 0; i < thread_count; ++i) {
+        pool->workers[i] = (MecsWorker){ pool, i };
+        if (pthread_create(&pool->threads[i], NULL, mecs_worker_main_, &pool->workers[i])) abort();
+        pool->thread_count++;
+    }
+}
+
+static inline void mecs_thread_pool_free(MecsThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < pool->thread_count; ++i) pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    pool->thread_count = 0;
+}
+
+// Runs task on every worker and on the caller, returning once all are done.
+static inline void mecs_thread_pool_run_(MecsThreadPool *pool, void (*task)(MecsThreadPool *, size_t),
+                                         void *ctx) {
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->task_ctx = ctx;
+    pool->job++;
+    pool->active = pool->thread_count;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    task(pool, pool->thread_count);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Runs fn over the matches of q on every worker and returns once all are
+// done. Sparse drivers are ignored: the parallel scan is always by word.
+static inline void mecs_parallel_for(MecsThreadPool *pool, MecsQuery q, MecsEntityFn fn, void *ctx) {
+    if (q.cursor == MECS_INVALID_ENTITY) return;
+    size_t chunks = ((size_t)*q.end + MECS_PARALLEL_CHUNK - 1) / MECS_PARALLEL_CHUNK;
+    size_t participants = pool->thread_count + 1;
+    if (participants > chunks) participants = chunks;
+    if (!participants) return;
+
+    pool->query = &q;
+    pool->end = *q.end;
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->range_count = participants;
+    for (size_t i = 0; i < participants; ++i) {
+        pool->ranges[i].next = i * chunks / participants;
+        pool->ranges[i].end = (i + 1) * chunks / participants;
+    }
+    mecs_thread_pool_run_(pool, mecs_parallel_run_, NULL);
+}
+
+#define MECS_PARALLEL_FOREACH(Pool, World, Fn, Ctx, ...) \
+    mecs_parallel_for((Pool), mecs_query_init(MECS_TERM_LIST_(MECS_TERMS_(World, __VA_ARGS__)), \
+                                              &(World)->em.high_water), (Fn), (Ctx))
+#endif
+
+// Systems. A MecsScheduler holds systems in their sequential order, each
+// with the components it reads and writes (named as in queries; a write
+// covers both values and membership). Two systems conflict when one writes
+// a component the other touches; a cached query spanning several
+// components updates its membership on a write to any of them, so those
+// components count as one for this. A system marked exclusive conflicts with
+// every other, as anything creating or destroying entities or flushing
+// commands must be. mecs_scheduler_run calls the systems in order;
+// mecs_scheduler_run_parallel turns conflicts with earlier systems into a
+// dependency DAG and runs each system on a thread pool as soon as its
+// predecessors are done, giving the same result. Systems run that way
+// must not themselves dispatch work to the same pool. When the scheduler
+// has a clock, both runners add each system's calls and elapsed clock
+// units to its runs and elapsed counters.
+#ifndef MECS_MAX_SYSTEMS
+#define MECS_MAX_SYSTEMS 64
+#endif
+
+#ifndef MECS_SYSTEM_MAX_ACCESS
+#define MECS_SYSTEM_MAX_ACCESS 16
+#endif
+
+#if MECS_MAX_SYSTEMS > 64
+#error "MECS_MAX_SYSTEMS is limited to 64"
+#endif
+
+typedef void (*MecsSystemFn)(void *world);
+
+typedef struct {
+    const char *name;
+    MecsSystemFn fn;
+    const MecsMask *reads[MECS_SYSTEM_MAX_ACCESS];
+    size_t read_count;
+    const MecsMask *writes[MECS_SYSTEM_MAX_ACCESS];
+    size_t write_count;
+    bool exclusive;
+    uint64_t runs, elapsed;
+} MecsSystem;
+
+typedef struct {
+    MecsSystem systems[MECS_MAX_SYSTEMS];
+    size_t count;
+    uint64_t after[MECS_MAX_SYSTEMS];
+    uint64_t (*clock)(void); // optional, for per-system timings
+} MecsScheduler;
+
+static inline size_t mecs_system_add(MecsScheduler *s, const char *name, MecsSystemFn fn) {
+    if (s->count >= MECS_MAX_SYSTEMS) abort();
+    s->systems[s->count] = (MecsSystem){ .name = name, .fn = fn };
+    return s->count++;
+}
+
+static inline void mecs_system_exclusive(MecsScheduler *s, size_t system) {
+    s->systems[system].exclusive = true;
+}
+
+static inline void mecs_system_access_(MecsScheduler *s, size_t system, const MecsTerm *terms, size_t count,
+                                       bool write) {
+    MecsSystem *sys = &s->systems[system];
+    const MecsMask **list = write ? sys->writes : sys->reads;
+    size_t *n = write ? &sys->write_count : &sys->read_count;
+    for (size_t i = 0; i < count; ++i) {
+        if (*n >= MECS_SYSTEM_MAX_ACCESS) abort();
+        list[(*n)++] = terms[i].mask;
+    }
+}
+
+#define MECS_SYSTEM_READS(Sched, System, World, ...) \
+    mecs_system_access_((Sched), (System), MECS_TERM_LIST_(MECS_TERMS_(World, __VA_ARGS__)), false)
+
+#define MECS_SYSTEM_WRITES(Sched, System, World, ...) \
+    mecs_system_access_((Sched), (System), MECS_TERM_LIST_(MECS_TERMS_(World, __VA_ARGS__)), true)
+
+// Whether a and b are the same mask or are both watched by one cached
+// query, whose update on a write to either reads the other and edits the
+// shared member set.
+static inline bool mecs_masks_coupled_(const MecsMask *a, const MecsMask *b) {
+    if (a == b) return true;
+    for (const MecsWatch *w = a->watchers; w; w = w->next) {
+        if (!w->query) continue;
+        const MecsQuery *q = &w->query->terms;
+        for (size_t i = 0; i < q->count; ++i)
+            if (q->terms[i] == b) return true;
+        for (size_t i = 0; i < q->excluded_count; ++i)
+            if (q->excluded[i] == b) return true;
+    }
+    return false;
+}
+
+static inline bool mecs_access_overlaps_(const MecsMask *const *a, size_t a_count,
+                                         const MecsMask *const *b, size_t b_count) {
+    for (size_t i = 0; i < a_count; ++i)
+        for (size_t j = 0; j < b_count; ++j)
+            if (mecs_masks_coupled_(a[i], b[j])) return true;
+    return false;
+}
+
+static inline bool mecs_systems_conflict_(const MecsSystem *a, const MecsSystem *b) {
+    return a->exclusive || b->exclusive ||
+           mecs_access_overlaps_(a->writes, a->write_count, b->writes, b->write_count) ||
+           mecs_access_overlaps_(a->writes, a->write_count, b->reads, b->read_count) ||
+           mecs_access_overlaps_(a->reads, a->read_count, b->writes, b->write_count);
+}
+
+// Rebuilds the DAG: after[j] has bit i set when system j must wait for
+// the earlier system i.
+static inline void mecs_scheduler_build(MecsScheduler *s) {
+    for (size_t j = 0; j < s->count; ++j) {
+        s->after[j] = 0;
+        for (size_t i = 0; i < j; ++i)
+            if (mecs_systems_conflict_(&s->systems[i], &s->systems[j]))
+                s->after[j] |= (uint64_t)1 << i;
+    }
+}
+
+static inline void mecs_system_call_(const MecsScheduler *s, MecsSystem *sys, void *world) {
+    if (!s->clock) {
+        sys->fn(world);
+        return;
+    }
+    uint64_t start = s->clock();
+    sys->fn(world);
+    sys->elapsed += s->clock() - start;
+    sys->runs++;
+}
+
+static inline void mecs_scheduler_run(MecsScheduler *s, void *world) {
+    for (size_t i = 0; i < s->count; ++i) mecs_system_call_(s, &s->systems[i], world);
+}
+
+#ifdef MECS_THREADS
+typedef struct {
+    MecsScheduler *sched;
+    void *world;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    uint64_t started, done;
+} MecsScheduleRun;
+
+// Each participant repeatedly claims the first system whose predecessors
+// are done, and leaves once every system has been claimed.
+static inline void mecs_schedule_task_(MecsThreadPool *pool, size_t worker) {
+    MecsScheduleRun *run = pool->task_ctx;
+    MecsScheduler *s = run->sched;
+    uint64_t all = s->count == 64 ? ~(uint64_t)0 : ((uint64_t)1 << s->count) - 1;
+    (void)worker;
+    pthread_mutex_lock(&run->lock);
+    while (run->started != all) {
+        size_t next = 0;
+        while (next < s->count &&
+               ((run->started >> next & 1) || (s->after[next] & ~run->done)))
+            ++next;
+        if (next == s->count) {
+            pthread_cond_wait(&run->ready, &run->lock);
+            continue;
+        }
+        run->started |= (uint64_t)1 << next;
+        pthread_mutex_unlock(&run->lock);
+        mecs_system_call_(s, &s->systems[next], run->world);
+        pthread_mutex_lock(&run->lock);
+        run->done |= (uint64_t)1 << next;
+        pthread_cond_broadcast(&run->ready);
+    }
+    pthread_mutex_unlock(&run->lock);
+}
+
+static inline void mecs_scheduler_run_parallel(MecsScheduler *s, MecsThreadPool *pool, void *world) {
+    MecsScheduleRun run = { .sched = s, .world = world };
+    mecs_scheduler_build(s);
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.ready, NULL);
+    mecs_thread_pool_run_(pool, mecs_schedule_task_, &run);
+    pthread_mutex_destroy(&run.lock);
+    pthread_cond_destroy(&run.ready);
+}
+#endif
+
+// Concurrent entity allocation, under MECS_THREADS. Each thread spawning
+// or destroying entities owns a MecsEntityCache of free ids. Creation pops
+// from the cache and otherwise bumps next_entity atomically; the alive
+// mask, high_water and generations are updated with atomics. An empty
+// cache refills with a batch claimed from the shared free list by one
+// compare-and-swap on free_count: between sync points the list only
+// shrinks and its contents do not move, so a claimed range is the
+// claimer's alone and no lock is needed. Destroyed ids are retired to the
+// cache: the entity stops existing at once, but its components stay until
+// mecs_entity_cache_flush, called single-threaded at a sync point, clears
+// them and returns the cache's ids to the shared list. Retired ids cannot
+// drain sooner, since reusing an id before its components are cleared
+// would hand the new entity the old one's components, and clearing them
+// is not safe while other threads read and write components.
+//
+// Threads set and clear components through per-thread command buffers.
+// These calls must not overlap the single-threaded entity API, and a
+// dynamic world has to mecs_entity_reserve its capacity up front: creation
+// returns MECS_INVALID_ENTITY once it is exhausted.
+#ifdef MECS_THREADS
+#ifndef MECS_ENTITY_CACHE
+#define MECS_ENTITY_CACHE 64
+#endif
+
+typedef struct {
+    Entity free[MECS_ENTITY_CACHE];
+    size_t free_count;
+    Entity *retired;
+    size_t retired_count, retired_capacity;
+} MecsEntityCache;
+
+// Claims up to half a cache of ids from the top of the shared free list.
+static inline void mecs_entity_cache_refill_(EntityManager *em, MecsEntityCache *cache) {
+    size_t shared = __atomic_load_n(&em->free_count, __ATOMIC_RELAXED), take;
+    do {
+        if (!shared) return;
+        take = shared < MECS_ENTITY_CACHE / 2 ? shared : MECS_ENTITY_CACHE / 2;
+    } while (!__atomic_compare_exchange_n(&em->free_count, &shared, shared - take, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    while (take) cache->free[cache->free_count++] = em->free_list[shared - take--];
+}
+
+static inline Entity mecs_entity_create_mt(EntityManager *em, MecsEntityCache *cache) {
+    Entity e;
+    if (!cache->free_count) mecs_entity_cache_refill_(em, cache);
+    if (cache->free_count) {
+        e = cache->free[--cache->free_count];
+    } else {
+        e = __atomic_load_n(&em->next_entity, __ATOMIC_RELAXED);
+        do {
+            if (e >= mecs_capacity(em)) return MECS_INVALID_ENTITY;
+        } while (!__atomic_compare_exchange_n(&em->next_entity, &e, e + 1, true,
+                                              __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+
+    uint64_t bit = (uint64_t)1 << (e & 63);
+    __atomic_fetch_or(&em->alive.bits[e >> 6], bit, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&em->alive.summary[e >> 12], (uint64_t)1 << ((e >> 6) & 63), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&em->alive.count, 1, __ATOMIC_RELAXED);
+    Entity top = __atomic_load_n(&em->high_water, __ATOMIC_RELAXED);
+    while (top <= e && !__atomic_compare_exchange_n(&em->high_water, &top, e + 1, true,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+    return e;
+}
+
+static inline void mecs_entity_destroy_mt(EntityManager *em, MecsEntityCache *cache, Entity e) {
+    uint64_t bit = (uint64_t)1 << (e & 63);
+    if (e >= __atomic_load_n(&em->next_entity, __ATOMIC_RELAXED)) return;
+    if (!(__atomic_fetch_and(&em->alive.bits[e >> 6], ~bit, __ATOMIC_RELAXED) & bit)) return;
+    __atomic_fetch_sub(&em->alive.count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&em->generations[e], 1, __ATOMIC_RELAXED);
+    if (cache->retired_count == cache->retired_capacity) {
+        cache->retired_capacity = cache->retired_capacity ? cache->retired_capacity * 2 : MECS_ENTITY_CACHE;
+        cache->retired = realloc(cache->retired, cache->retired_capacity * sizeof(Entity));
+        if (!cache->retired) abort();
+    }
+    cache->retired[cache->retired_count++] = e;
+}
+
+// Single-threaded: clears retired entities' components and hands every id
+// the cache holds back to the EntityManager.
+static inline void mecs_entity_cache_flush(EntityManager *em, MecsEntityCache *cache) {
+    for (size_t i = 0; i < cache->retired_count; ++i) {
+        Entity e = cache->retired[i];
+        mecs_relations_orphan_range_(em, e, 1);
+        mecs_components_clear_range_(em, e, 1);
+        if (!em->alive.bits[e >> 6]) em->alive.summary[e >> 12] &= ~((uint64_t)1 << ((e >> 6) & 63));
+        em->free_list[em->free_count++] = e;
+    }
+    while (cache->free_count) em->free_list[em->free_count++] = cache->free[--cache->free_count];
+    cache->retired_count = 0;
+    mecs_high_water_drop_(em);
+}
+
+static inline void mecs_entity_cache_free(MecsEntityCache *cache) {
+    free(cache->retired);
+    memset(cache, 0, sizeof(*cache));
+}
+#endif
+
+// Archetype storage: an alternative backend for worlds whose systems always
+// touch the same component combinations. Entities with identical component
+// sets share an archetype and live in fixed-size chunks, one SoA column per
+// component, so a query walks matching chunks linearly. A world using it
+// holds a MecsArchStore named `arch` next to its EntityManager and declares
+// components with MECS_DEFINE_ARCH_COMPONENT instead of MECS_DEFINE_COMPONENT.
+#ifndef MECS_CHUNK_SIZE
+#define MECS_CHUNK_SIZE (16 * 1024)
+#endif
+
+#ifndef MECS_MAX_ARCHETYPES
+#define MECS_MAX_ARCHETYPES 256
+#endif
+
+#define MECS_ARCH_MAX_COMPONENTS 64
+#define MECS_CHUNK_ALIGN 16
+
+typedef unsigned int MecsComponentId;
+typedef uint64_t MecsSignature;
+
+struct MecsArchetype;
+
+typedef struct {
+    const struct MecsArchetype *archetype;
+    size_t count;
+} MecsChunk;
+
+typedef struct MecsArchetype {
+    MecsSignature signature;
+    size_t rows;
+    size_t chunk_bytes;
+    size_t offsets[MECS_ARCH_MAX_COMPONENTS];
+    size_t entities_offset;
+    MecsChunk **chunks;
+    size_t chunk_count;
+    size_t chunk_cap;
+    size_t count;
+} MecsArchetype;
+
+typedef struct {
+    unsigned int archetype; // index + 1, 0 when the entity has no components
+    unsigned int row;
+} MecsArchRecord;
+
+typedef struct MecsArchStore {
+    size_t sizes[MECS_ARCH_MAX_COMPONENTS];
+    unsigned int component_count;
+    MecsArchetype archetypes[MECS_MAX_ARCHETYPES];
+    unsigned int archetype_count;
+    MECS_ARRAY(MecsArchRecord, records);
+} MecsArchStore;
+
+#define MECS_ALIGN_UP(n, a) (((n) + (a) - 1) / (a) * (a))
+
+static inline MecsComponentId mecs_arch_register(MecsArchStore *s, size_t size) {
+    if (s->component_count >= MECS_ARCH_MAX_COMPONENTS) abort();
+    s->sizes[s->component_count] = size;
+    return s->component_count++;
+}
+
+static inline Entity *mecs_chunk_entities(MecsChunk *chunk) {
+    return (Entity *)((char *)chunk + chunk->archetype->entities_offset);
+}
+
+static inline void *mecs_chunk_column(MecsChunk *chunk, MecsComponentId id) {
+    return (char *)chunk + chunk->archetype->offsets[id];
+}
+
+static inline size_t mecs_arch_layout_(const MecsArchStore *s, MecsArchetype *a, size_t rows) {
+    size_t off = MECS_ALIGN_UP(sizeof(MecsChunk), MECS_CHUNK_ALIGN);
+    a->entities_offset = off;
+    off += rows * sizeof(Entity);
+    for (MecsComponentId id = 0; id < s->component_count; ++id) {
+        if (!(a->signature >> id & 1)) continue;
+        off = MECS_ALIGN_UP(off, MECS_CHUNK_ALIGN);
+        a->offsets[id] = off;
+        off += rows * s->sizes[id];
+    }
+    return off;
+}
+
+static inline unsigned int mecs_arch_find_(MecsArchStore *s, MecsSignature sig) {
+    for (unsigned int i = 0; i < s->archetype_count; ++i)
+        if (s->archetypes[i].signature == sig) return i;
+    if (s->archetype_count >= MECS_MAX_ARCHETYPES) abort();
+
+    MecsArchetype *a = &s->archetypes[s->archetype_count];
+    memset(a, 0, sizeof(*a));
+    a->signature = sig;
+    size_t row_bytes = sizeof(Entity);
+    for (MecsComponentId id = 0; id < s->component_count; ++id)
+        if (sig >> id & 1) row_bytes += s->sizes[id];
+    size_t rows = MECS_CHUNK_SIZE / row_bytes;
+    while (rows > 1 && mecs_arch_layout_(s, a, rows) > MECS_CHUNK_SIZE) --rows;
+    if (rows == 0) rows = 1;
+    size_t bytes = mecs_arch_layout_(s, a, rows);
+    a->rows = rows;
+    a->chunk_bytes = bytes > MECS_CHUNK_SIZE ? bytes : MECS_CHUNK_SIZE;
+    return s->archetype_count++;
+}
+
+// Appends e to archetype a and returns its row.
+static inline size_t mecs_arch_push_(MecsArchetype *a, Entity e) {
+    size_t row = a->count++;
+    if (row / a->rows >= a->chunk_count) {
+        if (a->chunk_count == a->chunk_cap) {
+            a->chunk_cap = a->chunk_cap ? a->chunk_cap * 2 : 4;
+            a->chunks = realloc(a->chunks, a->chunk_cap * sizeof(*a->chunks));
+            if (!a->chunks) abort();
+        }
+        MecsChunk *chunk = malloc(a->chunk_bytes);
+        if (!chunk) abort();
+        chunk->archetype = a;
+        chunk->count = 0;
+        a->chunks[a->chunk_count++] = chunk;
+    }
+    MecsChunk *chunk = a->chunks[row / a->rows];
+    mecs_chunk_entities(chunk)[chunk->count++] = e;
+    return row;
+}
+
+static inline void *mecs_arch_cell_(MecsArchStore *s, MecsArchetype *a, size_t row, MecsComponentId id) {
+    return (char *)mecs_chunk_column(a->chunks[row / a->rows], id) + (row % a->rows) * s->sizes[id];
+}
+
+// Removes a row by moving the archetype's last row into it, keeping chunks dense.
+static inline void mecs_arch_pop_(MecsArchStore *s, MecsArchetype *a, size_t row) {
+    size_t last = --a->count;
+    MecsChunk *tail = a->chunks[last / a->rows];
+    if (row != last) {
+        Entity moved = mecs_chunk_entities(tail)[last % a->rows];
+        mecs_chunk_entities(a->chunks[row / a->rows])[row % a->rows] = moved;
+        for (MecsComponentId id = 0; id < s->component_count; ++id)
+            if (a->signature >> id & 1)
+                memcpy(mecs_arch_cell_(s, a, row, id), mecs_arch_cell_(s, a, last, id), s->sizes[id]);
+        s->records[moved].row = (unsigned int)row;
+    }
+    if (--tail->count == 0) {
+        free(tail);
+        a->chunk_count--;
+    }
+}
+
+// Moves e to the archetype for sig, carrying over the components both share.
+static inline void mecs_arch_move_(MecsArchStore *s, Entity e, MecsSignature sig) {
+    MecsArchRecord *r = &s->records[e];
+    MecsArchetype *from = r->archetype ? &s->archetypes[r->archetype - 1] : NULL;
+    if (sig == 0) {
+        if (from) mecs_arch_pop_(s, from, r->row);
+        r->archetype = 0;
+        return;
+    }
+    unsigned int to_index = mecs_arch_find_(s, sig);
+    MecsArchetype *to = &s->archetypes[to_index];
+    size_t row = mecs_arch_push_(to, e);
+    if (from) {
+        for (MecsComponentId id = 0; id < s->component_count; ++id)
+            if (sig >> id & 1 && from->signature >> id & 1)
+                memcpy(mecs_arch_cell_(s, to, row, id), mecs_arch_cell_(s, from, r->row, id), s->sizes[id]);
+        mecs_arch_pop_(s, from, r->row);
+    }
+    r->archetype = to_index + 1;
+    r->row = (unsigned int)row;
+}
+
+static inline MecsSignature mecs_arch_signature(const MecsArchStore *s, Entity e) {
+    unsigned int a = s->records[e].archetype;
+    return a ? s->archetypes[a - 1].signature : 0;
+}
+
+static inline bool mecs_arch_has(const MecsArchStore *s, Entity e, MecsComponentId id) {
+    return mecs_arch_signature(s, e) >> id & 1;
+}
+
+static inline void *mecs_arch_get(MecsArchStore *s, Entity e, MecsComponentId id) {
+    if (!mecs_arch_has(s, e, id)) return NULL;
+    return mecs_arch_cell_(s, &s->archetypes[s->records[e].archetype - 1], s->records[e].row, id);
+}
+
+static inline void *mecs_arch_set(MecsArchStore *s, Entity e, MecsComponentId id, const void *value) {
+    MecsSignature sig = mecs_arch_signature(s, e);
+    if (!(sig >> id & 1)) mecs_arch_move_(s, e, sig | (MecsSignature)1 << id);
+    void *cell = mecs_arch_get(s, e, id);
+    memcpy(cell, value, s->sizes[id]);
+    return cell;
+}
+
+static inline void mecs_arch_clear(MecsArchStore *s, Entity e, MecsComponentId id) {
+    MecsSignature sig = mecs_arch_signature(s, e);
+    if (sig >> id & 1) mecs_arch_move_(s, e, sig & ~((MecsSignature)1 << id));
+}
+
+static inline void mecs_arch_destroy(MecsArchStore *s, Entity e) {
+    mecs_arch_move_(s, e, 0);
+}
+
+// Copies each component src has onto dst, keeping the ones only dst has.
+static inline void mecs_arch_copy(MecsArchStore *s, Entity dst, Entity src) {
+    MecsSignature sig = mecs_arch_signature(s, src);
+    if (dst == src || !sig) return;
+    if ((mecs_arch_signature(s, dst) | sig) != mecs_arch_signature(s, dst))
+        mecs_arch_move_(s, dst, mecs_arch_signature(s, dst) | sig);
+    for (MecsComponentId id = 0; id < s->component_count; ++id)
+        if (sig >> id & 1) memcpy(mecs_arch_get(s, dst, id), mecs_arch_get(s, src, id), s->sizes[id]);
+}
+
+// Bytes of chunks and records behind the store for a world of capacity entities.
+static inline size_t mecs_arch_memory(const MecsArchStore *s, size_t capacity) {
+    size_t bytes = capacity * sizeof(MecsArchRecord);
+    for (unsigned int i = 0; i < s->archetype_count; ++i)
+        bytes += s->archetypes[i].chunk_count * s->archetypes[i].chunk_bytes +
+                 s->archetypes[i].chunk_cap * sizeof(MecsChunk *);
+    return bytes;
+}
+
+static inline void mecs_arch_free(MecsArchStore *s) {
+    for (unsigned int i = 0; i < s->archetype_count; ++i) {
+        MecsArchetype *a = &s->archetypes[i];
+        for (size_t c = 0; c < a->chunk_count; ++c) {
+            for (size_t r = 0; r < a->chunks[c]->count; ++r)
+                s->records[mecs_chunk_entities(a->chunks[c])[r]].archetype = 0;
+            free(a->chunks[c]);
+        }
+        free(a->chunks);
+    }
+    s->archetype_count = 0;
+}
+
+typedef struct {
+    MecsArchStore *store;
+    MecsSignature required;
+    unsigned int archetype;
+    size_t chunk;
+    bool once;
+} MecsArchQuery;
+
+static inline MecsChunk *mecs_arch_query_next(MecsArchQuery *q) {
+    for (; q->archetype < q->store->archetype_count; ++q->archetype, q->chunk = 0) {
+        MecsArchetype *a = &q->store->archetypes[q->archetype];
+        if ((a->signature & q->required) != q->required) continue;
+        if (q->chunk < a->chunk_count) return a->chunks[q->chunk++];
+    }
+    return NULL;
+}
+
+// The typed pointer is never set; it carries CompType so registration
+// can size the column and accessors can check the type they are given.
+#define MECS_DEFINE_ARCH_COMPONENT(CompType, Name) MecsComponentId Name##_id; CompType *Name##_type_
+
+// Fails to compile when CompType is not the type Name was defined with.
+#define MECS_ARCH_CHECK_(World, CompType, Name) ((void)sizeof((World)->Name##_type_ == (CompType *)0))
+
+// Ties the store to the world's EntityManager, once: destroying or
+// clearing an entity then drops its archetype row too, so a recycled id
+// starts out empty. Dynamic worlds also grow the store's records with it.
+static inline void mecs_register_arch_store(EntityManager *em, MecsArchStore *s) {
+    em->arch = s;
+#ifdef MECS_DYNAMIC
+    mecs_register_column(em, &s->records, sizeof(MecsArchRecord));
+#endif
+}
+
+#define MECS_REGISTER_ARCH_STORE(World) mecs_register_arch_store(&(World)->em, &(World)->arch)
+
+#define MECS_ARCH_REGISTER(World, Name) \
+    ((World)->Name##_id = mecs_arch_register(&(World)->arch, sizeof(*(World)->Name##_type_)))
+
+#define MECS_ARCH_BIT(World, Name) ((MecsSignature)1 << (World)->Name##_id)
+
+#define MECS_ARCH_HAS(World, Name, e) mecs_arch_has(&(World)->arch, (e), (World)->Name##_id)
+
+#define MECS_ARCH_GET(World, CompType, Name, e) \
+    (*(MECS_ARCH_CHECK_(World, CompType, Name), (CompType *)mecs_arch_get(&(World)->arch, (e), (World)->Name##_id)))
+
+#define MECS_ARCH_SET(World, CompType, Name, e, Value) do { \
+    CompType mecs_value_ = (Value); \
+    MECS_ARCH_CHECK_(World, CompType, Name); \
+    mecs_arch_set(&(World)->arch, (e), (World)->Name##_id, &mecs_value_); \
+} while (0)
+
+#define MECS_ARCH_CLEAR(World, Name, e) mecs_arch_clear(&(World)->arch, (e), (World)->Name##_id)
+
+#define MECS_ARCH_COLUMN(World, chunk, CompType, Name) \
+    (MECS_ARCH_CHECK_(World, CompType, Name), (CompType *)mecs_chunk_column((chunk), (World)->Name##_id))
+
+#define MECS_ARCH_FOREACH_CHUNK(World, Required, chunk) \
+    for (MecsArchQuery mecs_aq_##chunk = { &(World)->arch, (Required), 0, 0, true }; \
+         mecs_aq_##chunk.once; mecs_aq_##chunk.once = false) \
+        for (MecsChunk *chunk = mecs_arch_query_next(&mecs_aq_##chunk); chunk; \
+             chunk = mecs_arch_query_next(&mecs_aq_##chunk))
+
+#define MECS_ARCH_FOREACH_1(World, C1, chunk) \
+    MECS_ARCH_FOREACH_CHUNK(World, MECS_ARCH_BIT(World, C1), chunk)
+
+#define MECS_ARCH_FOREACH_2(World, C1, C2, chunk) \
+    MECS_ARCH_FOREACH_CHUNK(World, MECS_ARCH_BIT(World, C1) | MECS_ARCH_BIT(World, C2), chunk)
+
+#define MECS_ARCH_FOREACH_3(World, C1, C2, C3, chunk) \
+    MECS_ARCH_FOREACH_CHUNK(World, MECS_ARCH_BIT(World, C1) | MECS_ARCH_BIT(World, C2) | \
+                                   MECS_ARCH_BIT(World, C3), chunk)
+
 #endif // MINI_ECS_H